@@ -0,0 +1,208 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cr.h"
+#include "libmill.h"
+#include "list.h"
+#include "utils.h"
+
+/* Broadcast channel. Messages are stored in a ring buffer shared by all
+   the subscribers. Each subscriber has its own cursor into the ring. */
+struct mill_bchan_ {
+    /* The size of the elements stored in the channel, in bytes. */
+    size_t sz;
+    /* Number of messages the ring can hold. */
+    size_t cap;
+    /* What to do when the ring is full: MILL_BCH_DROP_ or MILL_BCH_BLOCK_. */
+    int policy;
+    /* Sequence number of the next message to be published. Message with
+       sequence number 'seq' is stored at position seq % cap. */
+    uint64_t head;
+    /* Number of subscribers. */
+    int nsubs;
+    /* Subscribers waiting for a new message. */
+    struct mill_list subwaiters;
+    /* Publishers waiting for a slot to be freed. Used only with
+       MILL_BCH_BLOCK_ policy. */
+    struct mill_list pubwaiters;
+    /* With MILL_BCH_BLOCK_ policy, for each slot, the number of subscribers
+       that haven't received the message yet. NULL otherwise. */
+    int *pending;
+    /* The ring buffer directly follows the structure. */
+};
+
+struct mill_bchsub_ {
+    struct mill_bchan_ *b;
+    /* Sequence number of the next message to be received. */
+    uint64_t cursor;
+    /* Number of messages the subscriber lost because it was too slow. */
+    uint64_t missed;
+};
+
+#define mill_bchslot(b, seq) \
+    (((char*)((b) + 1)) + ((seq) % (b)->cap) * (b)->sz)
+
+struct mill_bchan_ *mill_bchmake_(size_t sz, size_t cap, int policy,
+      const char *created) {
+    if(mill_slow(!cap || (policy != MILL_BCH_DROP_ &&
+          policy != MILL_BCH_BLOCK_))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    struct mill_bchan_ *b = malloc(sizeof(struct mill_bchan_) + sz * cap);
+    if(!b) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    b->pending = NULL;
+    if(policy == MILL_BCH_BLOCK_) {
+        b->pending = calloc(cap, sizeof(int));
+        if(!b->pending) {
+            free(b);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    b->sz = sz;
+    b->cap = cap;
+    b->policy = policy;
+    b->head = 0;
+    b->nsubs = 0;
+    mill_list_init(&b->subwaiters);
+    mill_list_init(&b->pubwaiters);
+    mill_trace(created, "bchmake(%d)", (int)cap);
+    return b;
+}
+
+struct mill_bchsub_ *mill_bchsubscribe_(struct mill_bchan_ *b,
+      const char *current) {
+    mill_trace(current, "bchsubscribe()");
+    struct mill_bchsub_ *s = malloc(sizeof(struct mill_bchsub_));
+    if(!s) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    s->b = b;
+    /* New subscriber gets only the messages published from now on. */
+    s->cursor = b->head;
+    s->missed = 0;
+    ++b->nsubs;
+    return s;
+}
+
+/* Subscriber is done with message 'seq'. */
+static void mill_bchrelease(struct mill_bchan_ *b, uint64_t seq) {
+    if(!b->pending)
+        return;
+    int *pending = &b->pending[seq % b->cap];
+    mill_assert(*pending > 0);
+    --*pending;
+    /* The oldest message was received by everybody. Publisher waiting for
+       the slot can proceed. */
+    if(!*pending && seq + b->cap == b->head &&
+          !mill_list_empty(&b->pubwaiters))
+        mill_wakeup(mill_cont(mill_list_begin(&b->pubwaiters),
+            struct mill_cr, waiter), 0);
+}
+
+void mill_bchunsubscribe_(struct mill_bchsub_ *s, const char *current) {
+    mill_trace(current, "bchunsubscribe()");
+    struct mill_bchan_ *b = s->b;
+    uint64_t seq;
+    for(seq = s->cursor; seq < b->head; ++seq)
+        mill_bchrelease(b, seq);
+    --b->nsubs;
+    free(s);
+}
+
+void mill_bchpub_(struct mill_bchan_ *b, void *val, size_t sz,
+      const char *current) {
+    mill_trace(current, "bchpub()");
+    if(mill_slow(b->sz != sz))
+        mill_panic("send of a type not matching the channel");
+    /* With the blocking policy, wait till all the subscribers have received
+       the message that is going to be overwritten. */
+    if(b->pending) {
+        while(b->head >= b->cap && b->pending[b->head % b->cap]) {
+            int rc = mill_waitfor(&b->pubwaiters, MILL_BCHPUB, -1, current);
+            if(mill_slow(rc == MILL_CANCELLED)) {
+                errno = ECANCELED;
+                return;
+            }
+        }
+        b->pending[b->head % b->cap] = b->nsubs;
+    }
+    memcpy(mill_bchslot(b, b->head), val, sz);
+    ++b->head;
+    while(!mill_list_empty(&b->subwaiters))
+        mill_wakeup(mill_cont(mill_list_begin(&b->subwaiters),
+            struct mill_cr, waiter), 0);
+    errno = 0;
+}
+
+void *mill_bchr_(struct mill_bchsub_ *s, size_t sz, const char *current) {
+    mill_trace(current, "bchr()");
+    struct mill_bchan_ *b = s->b;
+    if(mill_slow(b->sz != sz))
+        mill_panic("receive of a type not matching the channel");
+    while(s->cursor == b->head) {
+        int rc = mill_waitfor(&b->subwaiters, MILL_BCHR, -1, current);
+        if(mill_slow(rc == MILL_CANCELLED)) {
+            void *val = mill_valbuf(mill_running, sz);
+            memset(val, 0, sz);
+            errno = ECANCELED;
+            return val;
+        }
+    }
+    /* With the dropping policy the oldest messages may have been already
+       overwritten. Skip them. */
+    if(b->head - s->cursor > b->cap) {
+        s->missed += b->head - s->cursor - b->cap;
+        s->cursor = b->head - b->cap;
+    }
+    uint64_t seq = s->cursor++;
+    mill_bchrelease(b, seq);
+    errno = 0;
+    /* The message is copied directly from the ring by the caller. It stays
+       valid till this coroutine yields. */
+    return mill_bchslot(b, seq);
+}
+
+uint64_t mill_bchmissed_(struct mill_bchsub_ *s) {
+    return s->missed;
+}
+
+void mill_bchclose_(struct mill_bchan_ *b, const char *current) {
+    mill_trace(current, "bchclose()");
+    if(mill_slow(b->nsubs || !mill_list_empty(&b->pubwaiters)))
+        mill_panic(
+            "attempt to close a broadcast channel while it is still being used");
+    free(b->pending);
+    free(b);
+}
@@ -23,7 +23,9 @@
 */
 
 #include <assert.h>
+#include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,8 +38,55 @@
 
 MILL_CT_ASSERT(MILL_CLAUSELEN_ == sizeof(struct mill_clause));
 
+/* The inline fast paths in libmill.h see the beginning of the channel
+   as struct mill_chanhdr_. */
+#define MILL_CHANHDR_CHECK(field) \
+    MILL_CT_ASSERT(offsetof(struct mill_chan_, field) == \
+        offsetof(struct mill_chanhdr_, field))
+MILL_CHANHDR_CHECK(sz);
+MILL_CHANHDR_CHECK(buf);
+MILL_CHANHDR_CHECK(bufsz);
+MILL_CHANHDR_CHECK(mask);
+MILL_CHANHDR_CHECK(items);
+MILL_CHANHDR_CHECK(first);
+MILL_CHANHDR_CHECK(slow);
+
 static int mill_choose_seqnum = 0;
 
+/* Choose picks among multiple available clauses either randomly or
+   in round-robin fashion. Random numbers are generated by xorshift64*,
+   which is much cheaper than random() from libc. */
+#define MILL_CHOOSE_DEFAULT_SEED 0x9e3779b97f4a7c15ULL
+static int mill_choose_mode = MILL_CHOOSE_RANDOM_;
+static uint64_t mill_choose_rng = MILL_CHOOSE_DEFAULT_SEED;
+static unsigned int mill_choose_rr = 0;
+
+int mill_choosemode_(int mode, uint64_t seed) {
+    if(mill_slow(mode != MILL_CHOOSE_RANDOM_ &&
+          mode != MILL_CHOOSE_ROUNDROBIN_)) {
+        errno = EINVAL;
+        return -1;
+    }
+    mill_choose_mode = mode;
+    mill_choose_rng = seed ? seed : MILL_CHOOSE_DEFAULT_SEED;
+    mill_choose_rr = 0;
+    return 0;
+}
+
+/* Returns a number in the range of [0, n). */
+static int mill_choose_pick(int n) {
+    if(mill_choose_mode == MILL_CHOOSE_ROUNDROBIN_)
+        return (int)(mill_choose_rr++ % (unsigned int)n);
+    uint64_t x = mill_choose_rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    mill_choose_rng = x;
+    /* Map the upper 32 bits into the range without using division. */
+    uint32_t r = (uint32_t)((x * 0x2545f4914f6cdd1dULL) >> 32);
+    return (int)(((uint64_t)r * (uint32_t)n) >> 32);
+}
+
 struct mill_chan_ *mill_getchan(struct mill_ep *ep) {
     switch(ep->type) {
     case MILL_SENDER:
@@ -49,19 +98,130 @@ struct mill_chan_ *mill_getchan(struct mill_ep *ep) {
     }
 }
 
+/* Address of the element at position 'pos' in the channel's buffer. */
+#define mill_chslot(ch, pos) ((ch)->buf + ((pos) * (ch)->sz))
+
+/* Copies a single element. Most channels carry ints, pointers or other
+   small values; copies of those are done inline rather than by calling
+   memcpy with a size unknown at compile time. */
+static inline void mill_chcopy(void *dst, const void *src, size_t sz) {
+    switch(sz) {
+    case 4:
+        memcpy(dst, src, 4);
+        break;
+    case 8:
+        memcpy(dst, src, 8);
+        break;
+    case 16:
+        memcpy(dst, src, 16);
+        break;
+    default:
+        memcpy(dst, src, sz);
+    }
+}
+
+/* Deallocated channels are cached so that short-lived channels, such as
+   a reply channel created for each request, don't cost a malloc/free pair.
+   Channels are cached in a few classes, each holding channels with
+   the same element size and buffer size. Classes are assigned on demand
+   and become free once they are emptied. Channels with large buffers
+   are never cached. Cached channels are handed out in LIFO order so that
+   the reused memory is likely to still be in the CPU cache. */
+#define MILL_CHCACHE_CLASSES 8
+#define MILL_CHCACHE_MAXCHANS 64
+#define MILL_CHCACHE_MAXBUFSZ 1024
+
+struct mill_chcache {
+    size_t sz;
+    size_t ringsz;
+    int count;
+    struct mill_chan_ *chans[MILL_CHCACHE_MAXCHANS];
+};
+
+static struct mill_chcache mill_chcache[MILL_CHCACHE_CLASSES] = {{0}};
+
+static int mill_chcache_eligible(size_t sz, size_t ringsz) {
+    return sz <= MILL_CHCACHE_MAXBUFSZ && ringsz < MILL_CHCACHE_MAXBUFSZ &&
+        sz * (ringsz + 1) <= MILL_CHCACHE_MAXBUFSZ;
+}
+
+static struct mill_chcache *mill_chcache_find(size_t sz, size_t ringsz) {
+    if(!mill_chcache_eligible(sz, ringsz))
+        return NULL;
+    int i;
+    for(i = 0; i != MILL_CHCACHE_CLASSES; ++i) {
+        struct mill_chcache *cc = &mill_chcache[i];
+        if(cc->count && cc->sz == sz && cc->ringsz == ringsz)
+            return cc;
+    }
+    return NULL;
+}
+
+static struct mill_chan_ *mill_chcache_get(size_t sz, size_t ringsz) {
+    struct mill_chcache *cc = mill_chcache_find(sz, ringsz);
+    if(cc)
+        return cc->chans[--cc->count];
+    /* We are allocating 1 additional element after the channel buffer to
+       store the done-with value. It can't be stored in the regular buffer
+       because that would mean chdone() would block when buffer is full. */
+    return (struct mill_chan_*)
+        malloc(sizeof(struct mill_chan_) + (sz * (ringsz + 1)));
+}
+
+static void mill_chcache_put(struct mill_chan_ *ch) {
+    size_t ringsz = ch->mask + 1;
+    struct mill_chcache *cc = mill_chcache_find(ch->sz, ringsz);
+    if(!cc && mill_chcache_eligible(ch->sz, ringsz)) {
+        /* Start a new class, if there's an unused one. */
+        int i;
+        for(i = 0; i != MILL_CHCACHE_CLASSES; ++i) {
+            if(!mill_chcache[i].count) {
+                cc = &mill_chcache[i];
+                cc->sz = ch->sz;
+                cc->ringsz = ringsz;
+                break;
+            }
+        }
+    }
+    if(!cc || cc->count >= MILL_CHCACHE_MAXCHANS) {
+        free(ch);
+        return;
+    }
+    cc->chans[cc->count++] = ch;
+}
+
+/* Releases the cached channels when the process exits so that they don't
+   show up as leaks in memory checkers. */
+static __attribute__((destructor)) void mill_chcache_term(void) {
+    int i;
+    for(i = 0; i != MILL_CHCACHE_CLASSES; ++i) {
+        struct mill_chcache *cc = &mill_chcache[i];
+        while(cc->count)
+            free(cc->chans[--cc->count]);
+    }
+}
+
 struct mill_chan_ *mill_chmake_(size_t sz, size_t bufsz, const char *created) {
     /* If there's at least one channel created in the user's code
        we want the debug functions to get into the binary. */
     mill_preserve_debug();
-    /* We are allocating 1 additional element after the channel buffer to
-       store the done-with value. It can't be stored in the regular buffer
-       because that would mean chdone() would block when buffer is full. */
-    struct mill_chan_ *ch = (struct mill_chan_*)
-        malloc(sizeof(struct mill_chan_) + (sz * (bufsz + 1)));
+    /* Round the size of the buffer up to the power of two. The capacity of
+       the channel remains 'bufsz'. */
+    size_t ringsz = 1;
+    while(ringsz < bufsz) {
+        if(mill_slow(ringsz > SIZE_MAX / 2)) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        ringsz *= 2;
+    }
+    struct mill_chan_ *ch = mill_chcache_get(sz, ringsz);
     if(!ch)
         return NULL;
     mill_register_chan(&ch->debug, created);
     ch->sz = sz;
+    ch->buf = (char*)(ch + 1);
+    ch->slow = 0;
     ch->sender.type = MILL_SENDER;
     ch->sender.seqnum = mill_choose_seqnum;
     mill_list_init(&ch->sender.clauses);
@@ -70,7 +230,11 @@ struct mill_chan_ *mill_chmake_(size_t sz, size_t bufsz, const char *created) {
     mill_list_init(&ch->receiver.clauses);
     ch->refcount = 1;
     ch->done = 0;
+    ch->timer = NULL;
+    mill_list_init(&ch->watchers);
+    ch->pool = NULL;
     ch->bufsz = bufsz;
+    ch->mask = ringsz - 1;
     ch->items = 0;
     ch->first = 0;
     mill_trace(created, "<%d>=chmake(%d)", (int)ch->debug.id, (int)bufsz);
@@ -85,6 +249,112 @@ struct mill_chan_ *mill_chdup_(struct mill_chan_ *ch, const char *current) {
     return ch;
 }
 
+/* Every message allocated from a pool is preceded by this header. */
+struct mill_chmsg {
+    union {
+        /* Item in the free list, if the message is not in use. */
+        struct mill_slist_item item;
+        /* Make sure the payload is suitably aligned. */
+        long double align;
+    };
+    struct mill_chpool *pool;
+};
+
+/* Maximum number of free messages cached by a pool beyond the channel's
+   capacity. */
+#define MILL_CHPOOL_SPARE 16
+
+static void mill_chpool_free(struct mill_chpool *pool) {
+    while(1) {
+        struct mill_slist_item *it = mill_slist_pop(&pool->free);
+        if(!it)
+            break;
+        free(mill_cont(it, struct mill_chmsg, item));
+    }
+    free(pool);
+}
+
+static void mill_chpool_close(struct mill_chan_ *ch) {
+    /* Messages still stored in the channel are never going to be received.
+       Return them to the pool. */
+    while(ch->items) {
+        void *msg;
+        memcpy(&msg, mill_chslot(ch, ch->first), ch->sz);
+        ch->first = (ch->first + 1) & ch->mask;
+        --ch->items;
+        mill_chfree_(msg);
+    }
+    if(ch->pool->outstanding)
+        ch->pool->orphaned = 1;
+    else
+        mill_chpool_free(ch->pool);
+}
+
+struct mill_chan_ *mill_chmakep_(size_t msgsz, size_t bufsz,
+      const char *created) {
+    struct mill_chan_ *ch = mill_chmake_(sizeof(void*), bufsz, created);
+    if(!ch)
+        return NULL;
+    ch->pool = malloc(sizeof(struct mill_chpool));
+    if(!ch->pool) {
+        mill_chclose_(ch, created);
+        errno = ENOMEM;
+        return NULL;
+    }
+    ch->pool->msgsz = msgsz;
+    ch->pool->outstanding = 0;
+    mill_slist_init(&ch->pool->free);
+    ch->pool->nfree = 0;
+    ch->pool->orphaned = 0;
+    return ch;
+}
+
+void *mill_challoc_(struct mill_chan_ *ch) {
+    if(mill_slow(!ch))
+        mill_panic("null channel used");
+    struct mill_chpool *pool = ch->pool;
+    if(mill_slow(!pool))
+        mill_panic("challoc on a channel not created by chmakep");
+    struct mill_chmsg *msg;
+    struct mill_slist_item *it = mill_slist_pop(&pool->free);
+    if(it) {
+        msg = mill_cont(it, struct mill_chmsg, item);
+        --pool->nfree;
+    }
+    else {
+        msg = malloc(sizeof(struct mill_chmsg) + pool->msgsz);
+        if(mill_slow(!msg)) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        msg->pool = pool;
+    }
+    ++pool->outstanding;
+    return msg + 1;
+}
+
+void mill_chfree_(void *ptr) {
+    if(!ptr)
+        return;
+    struct mill_chmsg *msg = ((struct mill_chmsg*)ptr) - 1;
+    struct mill_chpool *pool = msg->pool;
+    mill_assert(pool->outstanding > 0);
+    --pool->outstanding;
+    if(mill_slow(pool->orphaned)) {
+        free(msg);
+        if(!pool->outstanding)
+            mill_chpool_free(pool);
+        return;
+    }
+    /* Don't cache more messages than can possibly be in flight. */
+    if(pool->nfree >= pool->outstanding + MILL_CHPOOL_SPARE) {
+        free(msg);
+        return;
+    }
+    mill_slist_push(&pool->free, &msg->item);
+    ++pool->nfree;
+}
+
 void mill_chclose_(struct mill_chan_ *ch, const char *current) {
     if(mill_slow(!ch))
         mill_panic("null channel used");
@@ -96,24 +366,37 @@ void mill_chclose_(struct mill_chan_ *ch, const char *current) {
     if(!mill_list_empty(&ch->sender.clauses) ||
           !mill_list_empty(&ch->receiver.clauses))
         mill_panic("attempt to close a channel while it is still being used");
+    if(ch->timer) {
+        if(mill_timer_enabled(&ch->timer->timer))
+            mill_timer_rm(&ch->timer->timer);
+        free(ch->timer);
+    }
+    mill_chset_chclose(ch);
+    if(ch->pool)
+        mill_chpool_close(ch);
     mill_unregister_chan(&ch->debug);
-    free(ch);
+    mill_chcache_put(ch);
 }
 
-/* Unblock a coroutine blocked in mill_choose_wait_() function.
-   It also cleans up the associated clause list. */
-static void mill_choose_unblock(struct mill_clause *cl) {
+void mill_choose_cancel(struct mill_cr *cr) {
     struct mill_slist_item *it;
     struct mill_clause *itcl;
-    for(it = mill_slist_begin(&cl->cr->choosedata.clauses);
+    for(it = mill_slist_begin(&cr->choosedata.clauses);
           it; it = mill_slist_next(it)) {
         itcl = mill_cont(it, struct mill_clause, chitem);
         if(!itcl->used)
             continue;
         mill_list_erase(&itcl->ep->clauses, &itcl->epitem);
+        --mill_getchan(itcl->ep)->slow;
     }
-    if(cl->cr->choosedata.ddline >= 0)
-        mill_timer_rm(&cl->cr->timer);
+    if(cr->choosedata.ddline >= 0)
+        mill_timer_rm(&cr->timer);
+}
+
+/* Unblock a coroutine blocked in mill_choose_wait_() function.
+   It also cleans up the associated clause list. */
+static void mill_choose_unblock(struct mill_clause *cl) {
+    mill_choose_cancel(cl->cr);
     mill_resume(cl->cr, cl->idx);
 }
 
@@ -205,6 +488,7 @@ static void mill_choose_callback(struct mill_timer *timer) {
         struct mill_clause *itcl = mill_cont(it, struct mill_clause, chitem);
         mill_assert(itcl->used);
         mill_list_erase(&itcl->ep->clauses, &itcl->epitem);
+        --mill_getchan(itcl->ep)->slow;
     }
     mill_resume(cr, -1);
 }
@@ -228,6 +512,11 @@ void mill_choose_otherwise_(void) {
     mill_running->choosedata.othws = 1;
 }
 
+/* Where to store the value received by an in clause. */
+static void *mill_chdst(struct mill_clause *cl, size_t sz) {
+    return cl->val ? cl->val : mill_valbuf(cl->cr, sz);
+}
+
 /* Push new item to the channel. */
 static void mill_enqueue(struct mill_chan_ *ch, void *val) {
     /* If there's a receiver already waiting, let's resume it. */
@@ -235,15 +524,29 @@ static void mill_enqueue(struct mill_chan_ *ch, void *val) {
         mill_assert(ch->items == 0);
         struct mill_clause *cl = mill_cont(
             mill_list_begin(&ch->receiver.clauses), struct mill_clause, epitem);
-        memcpy(mill_valbuf(cl->cr, ch->sz), val, ch->sz);
+        mill_chcopy(mill_chdst(cl, ch->sz), val, ch->sz);
         mill_choose_unblock(cl);
         return;
     }
     /* Write the value to the buffer. */
     assert(ch->items < ch->bufsz);
-    size_t pos = (ch->first + ch->items) % ch->bufsz;
-    memcpy(((char*)(ch + 1)) + (pos * ch->sz) , val, ch->sz);
+    size_t pos = (ch->first + ch->items) & ch->mask;
+    mill_chcopy(mill_chslot(ch, pos), val, ch->sz);
     ++ch->items;
+    if(mill_slow(!mill_list_empty(&ch->watchers)))
+        mill_chset_notify(ch);
+}
+
+static void mill_chtimer_callback(struct mill_timer *timer);
+
+/* Token was taken from a rate limiter. Make sure the bucket is being
+   refilled. */
+static void mill_chtimer_refill(struct mill_chan_ *ch) {
+    struct mill_chtimer *tm = ch->timer;
+    if(!tm->refill || mill_timer_enabled(&tm->timer))
+        return;
+    tm->expiry = mill_nowns_() + tm->period;
+    mill_timer_add(&tm->timer, tm->expiry, mill_chtimer_callback);
 }
 
 /* Pop one value from the channel. */
@@ -256,38 +559,131 @@ static void mill_dequeue(struct mill_chan_ *ch, void *val) {
            There are no senders waiting to send. */
         if(mill_slow(ch->done)) {
             mill_assert(!cl);
-            memcpy(val, ((char*)(ch + 1)) + (ch->bufsz * ch->sz), ch->sz);
+            memcpy(val, mill_chslot(ch, ch->mask + 1), ch->sz);
             return;
         }
         /* Otherwise there must be a sender waiting to send. */
         mill_assert(cl);
-        memcpy(val, cl->val, ch->sz);
+        mill_chcopy(val, cl->val, ch->sz);
         mill_choose_unblock(cl);
         return;
     }
     /* If there's a value in the buffer start by retrieving it. */
-    memcpy(val, ((char*)(ch + 1)) + (ch->first * ch->sz), ch->sz);
-    ch->first = (ch->first + 1) % ch->bufsz;
+    mill_chcopy(val, mill_chslot(ch, ch->first), ch->sz);
+    ch->first = (ch->first + 1) & ch->mask;
     --ch->items;
+    if(mill_slow(ch->timer))
+        mill_chtimer_refill(ch);
     /* And if there was a sender waiting, unblock it. */
     if(cl) {
         assert(ch->items < ch->bufsz);
-        size_t pos = (ch->first + ch->items) % ch->bufsz;
-        memcpy(((char*)(ch + 1)) + (pos * ch->sz) , cl->val, ch->sz);
+        size_t pos = (ch->first + ch->items) & ch->mask;
+        mill_chcopy(mill_chslot(ch, pos), cl->val, ch->sz);
         ++ch->items;
         mill_choose_unblock(cl);
     }
 }
 
+static void mill_chtimer_callback(struct mill_timer *timer) {
+    struct mill_chtimer *tm = mill_cont(timer, struct mill_chtimer, timer);
+    struct mill_chan_ *ch = tm->ch;
+    int64_t nw = now();
+    if(tm->refill) {
+        /* Hand out all the tokens accumulated since the last refill at once.
+           Waiting receivers get them first, the rest goes to the bucket. */
+        int64_t nwns = mill_nowns_();
+        int64_t n = (nwns - tm->expiry) / tm->period + 1;
+        tm->expiry += n * tm->period;
+        while(n && (!mill_list_empty(&ch->receiver.clauses) ||
+              ch->items < ch->bufsz)) {
+            mill_enqueue(ch, &nw);
+            --n;
+        }
+        /* If the bucket is full, the timer will be restarted once a token
+           is taken. */
+        if(ch->items < ch->bufsz)
+            mill_timer_add(timer, tm->expiry, mill_chtimer_callback);
+        return;
+    }
+    /* If the previous tick wasn't received yet, drop this one. */
+    if(!mill_list_empty(&ch->receiver.clauses) || ch->items < ch->bufsz)
+        mill_enqueue(ch, &nw);
+    if(!tm->period)
+        return;
+    /* Schedule the next tick relative to the previous one rather than to
+       the current time so that the ticker doesn't drift. Ticks that were
+       missed altogether are skipped. */
+    tm->expiry += tm->period;
+    int64_t nwns = mill_nowns_();
+    if(tm->expiry <= nwns)
+        tm->expiry += ((nwns - tm->expiry) / tm->period + 1) * tm->period;
+    mill_timer_add(timer, tm->expiry, mill_chtimer_callback);
+}
+
+static struct mill_chan_ *mill_chtimer(int64_t deadline, int64_t period,
+      size_t bufsz, const char *created) {
+    struct mill_chan_ *ch = mill_chmake_(sizeof(int64_t), bufsz, created);
+    if(!ch)
+        return NULL;
+    ch->timer = malloc(sizeof(struct mill_chtimer));
+    if(!ch->timer) {
+        mill_chclose_(ch, created);
+        errno = ENOMEM;
+        return NULL;
+    }
+    ch->timer->ch = ch;
+    ch->timer->period = period;
+    ch->timer->timer.expiry = -1;
+    ch->timer->expiry = deadline;
+    ch->timer->refill = 0;
+    ++ch->slow;
+    if(deadline >= 0)
+        mill_timer_add(&ch->timer->timer, deadline, mill_chtimer_callback);
+    return ch;
+}
+
+struct mill_chan_ *mill_chticker_(int64_t period, const char *created) {
+    if(period <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    period = mill_ms2ns(period);
+    return mill_chtimer(mill_nowns_() + period, period, 1, created);
+}
+
+struct mill_chan_ *mill_chafter_(int64_t deadline, const char *created) {
+    return mill_chtimer(mill_ms2ns(deadline), 0, 1, created);
+}
+
+struct mill_chan_ *mill_chlimiter_(int64_t rate, size_t burst,
+      const char *created) {
+    if(rate <= 0 || rate > 1000000000 || !burst) {
+        errno = EINVAL;
+        return NULL;
+    }
+    struct mill_chan_ *ch = mill_chtimer(-1, 1000000000 / rate, burst,
+        created);
+    if(!ch)
+        return NULL;
+    ch->timer->refill = 1;
+    /* The bucket starts full. */
+    int64_t nw = now();
+    while(ch->items < ch->bufsz)
+        mill_enqueue(ch, &nw);
+    return ch;
+}
+
 int mill_choose_wait_(void) {
     struct mill_choosedata *cd = &mill_running->choosedata;
     struct mill_slist_item *it;
     struct mill_clause *cl;
 
+    errno = 0;
+
     /* If there are clauses that are immediately available
        randomly choose one of them. */
     if(cd->available > 0) {
-        int chosen = cd->available == 1 ? 0 : (int)(random() % (cd->available));
+        int chosen = cd->available == 1 ? 0 : mill_choose_pick(cd->available);
         for(it = mill_slist_begin(&cd->clauses); it; it = mill_slist_next(it)) {
             cl = mill_cont(it, struct mill_clause, chitem);
             if(!cl->available)
@@ -300,7 +696,7 @@ int mill_choose_wait_(void) {
         if(cl->ep->type == MILL_SENDER)
             mill_enqueue(ch, cl->val);
         else
-            mill_dequeue(ch, mill_valbuf(cl->cr, ch->sz));
+            mill_dequeue(ch, mill_chdst(cl, ch->sz));
         mill_resume(mill_running, cl->idx);
         return mill_suspend();
     }
@@ -311,9 +707,17 @@ int mill_choose_wait_(void) {
         return mill_suspend();
     }
 
+    /* Cancelled coroutine can't do any more blocking operations. Those that
+       don't need to block are still allowed to succeed. */
+    if(mill_slow(mill_running->cancelled)) {
+        errno = ECANCELED;
+        return -1;
+    }
+
     /* If deadline was specified, start the timer. */
     if(cd->ddline >= 0)
-        mill_timer_add(&mill_running->timer, cd->ddline, mill_choose_callback);
+        mill_timer_add(&mill_running->timer, mill_ms2ns(cd->ddline),
+            mill_choose_callback);
 
     /* In all other cases register this coroutine with the queried channels
        and wait till one of the clauses unblocks. */
@@ -322,7 +726,7 @@ int mill_choose_wait_(void) {
         if(mill_slow(cl->ep->refs > 1)) {
             if(cl->ep->tmp == -1)
                 cl->ep->tmp =
-                    cl->ep->refs == 1 ? 0 : (int)(random() % cl->ep->refs);
+                    cl->ep->refs == 1 ? 0 : mill_choose_pick(cl->ep->refs);
             if(cl->ep->tmp) {
                 --cl->ep->tmp;
                 cl->used = 0;
@@ -331,10 +735,22 @@ int mill_choose_wait_(void) {
             cl->ep->tmp = -2;
         }
         mill_list_insert(&cl->ep->clauses, &cl->epitem, NULL);
+        struct mill_chan_ *ch = mill_getchan(cl->ep);
+        ++ch->slow;
+        /* Blocked sender makes the channel readable. */
+        if(cl->ep->type == MILL_SENDER) {
+            if(mill_slow(!mill_list_empty(&ch->watchers)))
+                mill_chset_notify(ch);
+        }
     }
     /* If there are multiple parallel chooses done from different coroutines
        all but one must be blocked on the following line. */
-    return mill_suspend();
+    int rc = mill_suspend();
+    if(mill_slow(rc == MILL_CANCELLED)) {
+        errno = ECANCELED;
+        return -1;
+    }
+    return rc;
 }
 
 void *mill_choose_val_(size_t sz) {
@@ -364,8 +780,31 @@ void *mill_chr_(struct mill_chan_ *ch, size_t sz, const char *current) {
     mill_choose_init(current);
     struct mill_clause cl;
     mill_choose_in_(&cl, ch, sz, 0);
-    mill_choose_wait_();
-    return mill_choose_val_(sz);
+    int rc = mill_choose_wait_();
+    void *val = mill_choose_val_(sz);
+    /* If cancelled, return zeroes rather than whatever is in the buffer. */
+    if(mill_slow(rc < 0))
+        memset(val, 0, sz);
+    return val;
+}
+
+int mill_chrto_(struct mill_chan_ *ch, void *dst, size_t sz,
+      const char *current) {
+    if(mill_slow(!ch))
+        mill_panic("null channel used");
+    mill_trace(current, "chrto(<%d>)", (int)ch->debug.id);
+    mill_running->state = MILL_CHR;
+    mill_choose_init(current);
+    struct mill_clause cl;
+    mill_choose_in_(&cl, ch, sz, 0);
+    /* The sender copies the value straight into the destination. */
+    cl.val = dst;
+    int rc = mill_choose_wait_();
+    if(mill_slow(rc < 0)) {
+        memset(dst, 0, sz);
+        return -1;
+    }
+    return 0;
 }
 
 void mill_chdone_(struct mill_chan_ *ch, void *val, size_t sz,
@@ -382,14 +821,17 @@ void mill_chdone_(struct mill_chan_ *ch, void *val, size_t sz,
         mill_panic("send to done-with channel");
     /* Put the channel into done-with mode. */
     ch->done = 1;
+    ++ch->slow;
     /* Store the terminal value into a special position in the channel. */
-    memcpy(((char*)(ch + 1)) + (ch->bufsz * ch->sz) , val, ch->sz);
+    memcpy(mill_chslot(ch, ch->mask + 1), val, ch->sz);
     /* Resume all the receivers currently waiting on the channel. */
     while(!mill_list_empty(&ch->receiver.clauses)) {
         struct mill_clause *cl = mill_cont(
             mill_list_begin(&ch->receiver.clauses), struct mill_clause, epitem);
-        memcpy(mill_valbuf(cl->cr, ch->sz), val, ch->sz);
+        memcpy(mill_chdst(cl, ch->sz), val, ch->sz);
         mill_choose_unblock(cl);
     }
+    if(mill_slow(!mill_list_empty(&ch->watchers)))
+        mill_chset_notify(ch);
 }
 
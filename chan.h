@@ -30,6 +30,7 @@
 #include "debug.h"
 #include "list.h"
 #include "slist.h"
+#include "timer.h"
 
 /* One of these structures is preallocated for every coroutine. */
 struct mill_choosedata {
@@ -60,8 +61,31 @@ struct mill_ep {
 
 /* Channel. */
 struct mill_chan_ {
+    /* The fields up to and including 'slow' are accessed by the inline fast
+       paths in libmill.h. They must match struct mill_chanhdr_. */
+
     /* The size of the elements stored in the channel, in bytes. */
     size_t sz;
+
+    /* The message buffer directly follows the chan structure and 'buf'
+       points to it. 'bufsz' specifies the maximum capacity of the buffer.
+       'items' is the number of messages currently in the buffer. 'first' is
+       the index of the next message to be received from the buffer.
+       The buffer itself is allocated with a power-of-two number of elements
+       so that positions can be wrapped using 'mask' instead of a division.
+       There's one extra element at the end of the buffer used to store
+       the message supplied by chdone() function. */
+    char *buf;
+    size_t bufsz;
+    size_t mask;
+    size_t items;
+    size_t first;
+
+    /* Number of reasons why the fast paths can't be used: clauses blocked
+       on the channel, channel sets watching it, chdone() having been called
+       and a timer feeding the channel. */
+    int slow;
+
     /* Channel holds two lists, the list of clauses waiting to send and list
        of clauses waiting to receive. */
     struct mill_ep sender;
@@ -70,20 +94,47 @@ struct mill_chan_ {
     int refcount;
     /* 1 is chdone() was already called. 0 otherwise. */
     int done;
-
-    /* The message buffer directly follows the chan structure. 'bufsz' specifies
-       the maximum capacity of the buffer. 'items' is the number of messages
-       currently in the buffer. 'first' is the index of the next message to
-       be received from the buffer. There's one extra element at the end of
-       the buffer used to store the message supplied by chdone() function. */
-    size_t bufsz;
-    size_t items;
-    size_t first;
+    /* The timer feeding the channel for channels created by chticker()
+       and chafter(). NULL for ordinary channels. */
+    struct mill_chtimer *timer;
+    /* List of channel sets the channel is part of. */
+    struct mill_list watchers;
+    /* Pool of messages for channels created by chmakep(). NULL for
+       ordinary channels. */
+    struct mill_chpool *pool;
 
     /* Debugging info. */
     struct mill_debug_chan debug;
 };
 
+/* Pool of message buffers owned by a pointer channel. Buffers not in use
+   are kept in the free list to be reused by subsequent challoc() calls. */
+struct mill_chpool {
+    /* Size of a message, in bytes. */
+    size_t msgsz;
+    /* Messages allocated from the pool and not yet returned. */
+    size_t outstanding;
+    /* Free messages. */
+    struct mill_slist free;
+    size_t nfree;
+    /* 1 if the channel was already deallocated. The pool is deallocated once
+       the last outstanding message is returned. */
+    int orphaned;
+};
+
+/* Timer that sends current time to a channel when it expires. */
+struct mill_chtimer {
+    struct mill_timer timer;
+    struct mill_chan_ *ch;
+    /* Period of the ticker in nanoseconds. 0 for one-shot timers. */
+    int64_t period;
+    /* When the timer was supposed to expire the last time it was armed. */
+    int64_t expiry;
+    /* 1 if the timer refills the token bucket of a rate limiter. Such timer
+       is stopped while the bucket is full. */
+    int refill;
+};
+
 /* This structure represents a single clause in a choose statement.
    Similarly, both chs() and chr() each create a single clause. */
 struct mill_clause {
@@ -95,7 +146,8 @@ struct mill_clause {
     struct mill_cr *cr;
     /* Channel endpoint the clause is waiting for. */
     struct mill_ep *ep;
-    /* For out clauses, pointer to the value to send. NULL for in clauses. */
+    /* For out clauses, pointer to the value to send. For in clauses, where
+       to store the received value. NULL means the receiver's valbuf. */
     void *val;
     /* The index to jump to when the clause is executed. */
     int idx;
@@ -106,6 +158,17 @@ struct mill_clause {
     int used;
 };
 
+/* Removes the coroutine blocked in a choose statement from all the channels
+   it is waiting for. */
+void mill_choose_cancel(struct mill_cr *cr);
+
+/* Marks the channel as ready in all the channel sets it belongs to.
+   Called when the channel may have become readable. */
+void mill_chset_notify(struct mill_chan_ *ch);
+
+/* Removes the channel being deallocated from all the channel sets. */
+void mill_chset_chclose(struct mill_chan_ *ch);
+
 /* Returns pointer to the channel that contains specified endpoint. */
 struct mill_chan_ *mill_getchan(struct mill_ep *ep);
 
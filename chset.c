@@ -0,0 +1,211 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "chan.h"
+#include "cr.h"
+#include "libmill.h"
+#include "list.h"
+#include "utils.h"
+
+/* Membership of a channel in a channel set. */
+struct mill_chsetitem {
+    struct mill_chan_ *ch;
+    struct mill_chset_ *set;
+    /* Item in the channel's list of sets watching it. */
+    struct mill_list_item chitem;
+    /* Item in the set's list of all the channels. */
+    struct mill_list_item setitem;
+    /* Item in the set's list of ready channels. */
+    struct mill_list_item readyitem;
+    /* 1 if the item is in the ready list. */
+    int ready;
+};
+
+struct mill_chset_ {
+    /* All the channels in the set. */
+    struct mill_list members;
+    /* Channels that may have a message to receive. */
+    struct mill_list ready;
+    /* Coroutines blocked in chsetwait(). */
+    struct mill_list waiters;
+};
+
+/* Returns 1 if chr() on the channel would not block. */
+static int mill_chset_readable(struct mill_chan_ *ch) {
+    return ch->items || ch->done || !mill_list_empty(&ch->sender.clauses);
+}
+
+static void mill_chset_mark(struct mill_chsetitem *item) {
+    if(item->ready)
+        return;
+    mill_list_insert(&item->set->ready, &item->readyitem, NULL);
+    item->ready = 1;
+    while(!mill_list_empty(&item->set->waiters)) {
+        struct mill_cr *cr = mill_cont(mill_list_begin(&item->set->waiters),
+            struct mill_cr, waiter);
+        mill_wakeup(cr, 0);
+    }
+}
+
+void mill_chset_notify(struct mill_chan_ *ch) {
+    struct mill_list_item *it;
+    for(it = mill_list_begin(&ch->watchers); it; it = mill_list_next(it))
+        mill_chset_mark(mill_cont(it, struct mill_chsetitem, chitem));
+}
+
+static void mill_chset_erase(struct mill_chsetitem *item) {
+    mill_list_erase(&item->ch->watchers, &item->chitem);
+    --item->ch->slow;
+    mill_list_erase(&item->set->members, &item->setitem);
+    if(item->ready)
+        mill_list_erase(&item->set->ready, &item->readyitem);
+    free(item);
+}
+
+void mill_chset_chclose(struct mill_chan_ *ch) {
+    while(!mill_list_empty(&ch->watchers))
+        mill_chset_erase(mill_cont(mill_list_begin(&ch->watchers),
+            struct mill_chsetitem, chitem));
+}
+
+struct mill_chset_ *mill_chsetmake_(void) {
+    struct mill_chset_ *s = malloc(sizeof(struct mill_chset_));
+    if(!s) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    mill_list_init(&s->members);
+    mill_list_init(&s->ready);
+    mill_list_init(&s->waiters);
+    return s;
+}
+
+static struct mill_chsetitem *mill_chset_find(struct mill_chset_ *s,
+      struct mill_chan_ *ch) {
+    struct mill_list_item *it;
+    for(it = mill_list_begin(&ch->watchers); it; it = mill_list_next(it)) {
+        struct mill_chsetitem *item =
+            mill_cont(it, struct mill_chsetitem, chitem);
+        if(item->set == s)
+            return item;
+    }
+    return NULL;
+}
+
+int mill_chsetadd_(struct mill_chset_ *s, struct mill_chan_ *ch,
+      const char *current) {
+    if(mill_slow(!ch))
+        mill_panic("null channel used");
+    mill_trace(current, "chsetadd(<%d>)", (int)ch->debug.id);
+    if(mill_chset_find(s, ch)) {
+        errno = EEXIST;
+        return -1;
+    }
+    struct mill_chsetitem *item = malloc(sizeof(struct mill_chsetitem));
+    if(!item) {
+        errno = ENOMEM;
+        return -1;
+    }
+    item->ch = ch;
+    item->set = s;
+    item->ready = 0;
+    mill_list_insert(&ch->watchers, &item->chitem, NULL);
+    ++ch->slow;
+    mill_list_insert(&s->members, &item->setitem, NULL);
+    if(mill_chset_readable(ch))
+        mill_chset_mark(item);
+    return 0;
+}
+
+int mill_chsetrm_(struct mill_chset_ *s, struct mill_chan_ *ch,
+      const char *current) {
+    if(mill_slow(!ch))
+        mill_panic("null channel used");
+    mill_trace(current, "chsetrm(<%d>)", (int)ch->debug.id);
+    struct mill_chsetitem *item = mill_chset_find(s, ch);
+    if(!item) {
+        errno = ENOENT;
+        return -1;
+    }
+    mill_chset_erase(item);
+    return 0;
+}
+
+int mill_chsetwait_(struct mill_chset_ *s, struct mill_chan_ **chans,
+      int nchans, int64_t deadline, const char *current) {
+    mill_trace(current, "chsetwait()");
+    while(1) {
+        /* Go through the ready list. Channels that were drained meanwhile
+           are dropped from it. Ready channels are moved to the end of the
+           list so that all of them get their turn. Thus, the cost depends
+           only on the number of ready channels, not on the size of
+           the set. */
+        int n = 0;
+        struct mill_list_item *last = s->ready.last;
+        while(n < nchans && !mill_list_empty(&s->ready)) {
+            struct mill_list_item *it = mill_list_begin(&s->ready);
+            struct mill_chsetitem *item =
+                mill_cont(it, struct mill_chsetitem, readyitem);
+            mill_list_erase(&s->ready, it);
+            if(!mill_chset_readable(item->ch))
+                item->ready = 0;
+            else {
+                mill_list_insert(&s->ready, it, NULL);
+                chans[n++] = item->ch;
+            }
+            if(it == last)
+                break;
+        }
+        if(n > 0) {
+            errno = 0;
+            return n;
+        }
+        if(deadline == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        int rc = mill_waitfor(&s->waiters, MILL_CHSETWAIT, deadline, current);
+        if(rc == -1) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if(rc == MILL_CANCELLED) {
+            errno = ECANCELED;
+            return -1;
+        }
+    }
+}
+
+void mill_chsetclose_(struct mill_chset_ *s, const char *current) {
+    mill_trace(current, "chsetclose()");
+    if(mill_slow(!mill_list_empty(&s->waiters)))
+        mill_panic("attempt to close a channel set while it is still being used");
+    while(!mill_list_empty(&s->members))
+        mill_chset_erase(mill_cont(mill_list_begin(&s->members),
+            struct mill_chsetitem, setitem));
+    free(s);
+}
@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #if defined MILL_VALGRIND
 #include <valgrind/valgrind.h>
@@ -48,15 +49,31 @@ char mill_main_valbuf[128];
 volatile int mill_unoptimisable1_ = 1;
 volatile void *mill_unoptimisable2_ = NULL;
 
-struct mill_cr mill_main = {0};
+struct mill_cr mill_main = {
+    .prio = MILL_DEFAULT_PRIO, .fd = -1, .timer = {.expiry = -1}};
 
 struct mill_cr *mill_running = &mill_main;
 
-/* Queue of coroutines scheduled for execution. */
-struct mill_slist mill_ready = {0};
+/* Queues of coroutines scheduled for execution, one per priority level.
+   Bit N in mill_ready_mask is set if the queue for priority N is not
+   empty. */
+static struct mill_slist mill_ready[MILL_NPRIOS] = {{0}};
+static unsigned int mill_ready_mask = 0;
+
+/* After this many consecutive picks of a higher-priority coroutine while
+   there are lower-priority coroutines waiting, a lower-priority coroutine
+   is given a chance to run. This way lower priorities are never starved. */
+#define MILL_PRIO_AGING 32
+
+/* Number of consecutive picks done while lower priorities were waiting. */
+static int mill_starving = 0;
+
+/* The priority to start the search from next time the aging kicks in.
+   Rotating it makes sure that all the lower priorities get their turn. */
+static int mill_aging_prio = 0;
 
 inline mill_ctx mill_getctx_(void) {
-#if defined __x86_64__
+#if defined __x86_64__ || defined __aarch64__
     return mill_running->ctx;
 #else
     return &mill_running->ctx;
@@ -101,36 +118,114 @@ void mill_goprepare_(int count, size_t stack_size, size_t val_size) {
         sizeof(struct mill_cr));
 }
 
+/* Returns the priority of the coroutine to run next. There must be at least
+   one coroutine ready to run. */
+static int mill_pickprio(void) {
+    int prio = __builtin_ctz(mill_ready_mask);
+    /* If there are no lower-priority coroutines waiting there's no danger
+       of starvation. */
+    if(mill_fast(!(mill_ready_mask >> (prio + 1)))) {
+        mill_starving = 0;
+        return prio;
+    }
+    if(mill_fast(++mill_starving < MILL_PRIO_AGING))
+        return prio;
+    mill_starving = 0;
+    mill_aging_prio = mill_aging_prio % (MILL_NPRIOS - 1) + 1;
+    int start = mill_aging_prio > prio ? mill_aging_prio : prio + 1;
+    unsigned int lower = mill_ready_mask >> start;
+    if(lower)
+        return start + __builtin_ctz(lower);
+    /* Nothing is waiting at or below the rotating priority. Pick the lowest
+       priority that is waiting. */
+    return 31 - __builtin_clz(mill_ready_mask);
+}
+
+/* Even if process never gets idle, we have to process external events
+   once in a while. The external signal may very well be a deadline or
+   a user-issued command that cancels the CPU intensive operation. Events
+   are processed after specified number of context switches (0 means never)
+   and/or once specified number of nanoseconds have elapsed since the last
+   check (-1 means never). */
+static int mill_poll_switches = 103;
+static int64_t mill_poll_interval = -1;
+
+/* Time of the last check for external events. Maintained only if
+   mill_poll_interval is set. */
+static int64_t mill_last_poll = 0;
+
+struct mill_pollstats mill_stats = {0};
+
+void mill_setpoll_(int switches, int64_t interval) {
+    mill_poll_switches = switches > 0 ? switches : 0;
+    mill_poll_interval = interval >= 0 ? interval * 1000 : -1;
+    if(mill_poll_interval >= 0)
+        mill_last_poll = mill_nowns_();
+}
+
+void mill_pollstats_(struct mill_pollstats *stats) {
+    *stats = mill_stats;
+}
+
 int mill_suspend(void) {
-    /* Even if process never gets idle, we have to process external events
-       once in a while. The external signal may very well be a deadline or
-       a user-issued command that cancels the CPU intensive operation. */
     static int counter = 0;
-    if(counter >= 103) {
+    if(mill_slow(mill_poll_switches && counter >= mill_poll_switches)) {
+        ++mill_stats.switches;
         mill_wait(0);
         counter = 0;
+        if(mill_poll_interval >= 0)
+            mill_last_poll = mill_nowns_();
+    }
+    else if(mill_slow(mill_poll_interval >= 0)) {
+        int64_t nw = mill_nowns_();
+        if(nw - mill_last_poll >= mill_poll_interval) {
+            ++mill_stats.timeouts;
+            mill_wait(0);
+            counter = 0;
+            mill_last_poll = nw;
+        }
     }
+#if defined __x86_64__ || defined __aarch64__
+    /* The context of the current coroutine, if any, is stored by the very
+       same call that switches to the next one. */
+    struct mill_cr *prev = mill_running;
+#else
     /* Store the context of the current coroutine, if any. */
     if(mill_running) {
         mill_ctx ctx = mill_getctx_();
         if (mill_setjmp_(ctx))
             return mill_running->result;
     }
+#endif
     while(1) {
         /* If there's a coroutine ready to be executed go for it. */
-        if(!mill_slist_empty(&mill_ready)) {
+        if(mill_ready_mask) {
             ++counter;
-            struct mill_slist_item *it = mill_slist_pop(&mill_ready);
+            int prio = mill_pickprio();
+            struct mill_slist_item *it = mill_slist_pop(&mill_ready[prio]);
+            if(mill_slist_empty(&mill_ready[prio]))
+                mill_ready_mask &= ~(1u << prio);
             mill_running = mill_cont(it, struct mill_cr, ready);
             mill_assert(mill_running->is_ready == 1);
             mill_running->is_ready = 0;
+#if defined __x86_64__ || defined __aarch64__
+            if(prev) {
+                if(mill_running != prev)
+                    mill_ctxswap(prev->ctx, mill_running->ctx);
+                return mill_running->result;
+            }
+#endif
             mill_longjmp_(mill_getctx_());
         }
         /* Otherwise, we are going to wait for sleeping coroutines
-           and for external events. */
+           and for external events. Note that a timer may fire without
+           resuming any coroutine (e.g. a tick nobody is receiving) so we
+           may end up here once again. */
+        ++mill_stats.idle;
         mill_wait(1);
-        mill_assert(!mill_slist_empty(&mill_ready));
         counter = 0;
+        if(mill_poll_interval >= 0)
+            mill_last_poll = mill_nowns_();
     }
 }
 
@@ -139,7 +234,20 @@ inline void mill_resume(struct mill_cr *cr, int result) {
     cr->result = result;
     cr->state = MILL_READY;
     cr->is_ready = 1;
-    mill_slist_push_back(&mill_ready, &cr->ready);
+    mill_slist_push_back(&mill_ready[cr->prio], &cr->ready);
+    mill_ready_mask |= 1u << cr->prio;
+}
+
+int mill_setprio_(int prio, const char *current) {
+    mill_trace(current, "setprio(%d)", prio);
+    if(mill_slow(prio < 0 || prio >= MILL_NPRIOS)) {
+        errno = EINVAL;
+        return -1;
+    }
+    int old = mill_running->prio;
+    mill_running->prio = prio;
+    errno = 0;
+    return old;
 }
 
 /* mill_prologue_() and mill_epilogue_() live in the same scope with
@@ -153,14 +261,15 @@ inline void mill_resume(struct mill_cr *cr, int result) {
 #error "Unsupported compiler!"
 #endif
 
-/* The intial part of go(). Starts the new coroutine.
-   Returns the pointer to the top of its stack. */
-__attribute__((noinline)) dill_noopt
-void *mill_prologue_(const char *created) {
-    /* Ensure that debug functions are available whenever a single go()
-       statement is present in the user's code. */
-    mill_preserve_debug();
-    /* Allocate and initialise new stack. */
+/* Handle created by goh() to be attached to the coroutine being launched. */
+static struct mill_gohandle_ *mill_nexthandle = NULL;
+
+/* Group the coroutine being launched by groupgo() should be added to. */
+static struct mill_group_ *mill_nextgroup = NULL;
+
+/* Allocates a stack for a new coroutine and initialises the mill_cr
+   structure on its top. The coroutine is neither running nor ready. */
+static struct mill_cr *mill_newcr(const char *created) {
 #if defined MILL_VALGRIND
     size_t stack_size;
     struct mill_cr *cr = ((struct mill_cr*)mill_allocstack(&stack_size));
@@ -171,6 +280,7 @@ void *mill_prologue_(const char *created) {
     struct mill_cr *cr = ((struct mill_cr*)mill_allocstack(NULL)) - 1;
 #endif
     mill_register_cr(&cr->debug, created);
+    cr->state = MILL_READY;
     cr->is_ready = 0;
     cr->valbuf = NULL;
     cr->valbuf_sz = 0;
@@ -178,6 +288,56 @@ void *mill_prologue_(const char *created) {
     cr->timer.expiry = -1;
     cr->fd = -1;
     cr->events = 0;
+    cr->prio = MILL_DEFAULT_PRIO;
+    cr->cancelled = 0;
+    cr->handle = mill_nexthandle;
+    mill_nexthandle = NULL;
+    if(cr->handle) {
+        cr->handle->cr = cr;
+        cr->handle->id = cr->debug.id;
+    }
+    cr->group = mill_nextgroup;
+    mill_nextgroup = NULL;
+    if(cr->group) {
+        mill_list_insert(&cr->group->members, &cr->groupitem, NULL);
+        cr->cancelled = cr->group->cancelled;
+    }
+    cr->waiters = NULL;
+    return cr;
+}
+
+/* Lets everybody waiting in gojoin() know that the coroutine has finished. */
+static void mill_gohandle_done(struct mill_gohandle_ *h) {
+    h->cr = NULL;
+    while(!mill_list_empty(&h->joiners))
+        mill_wakeup(mill_cont(mill_list_begin(&h->joiners), struct mill_cr,
+            waiter), 0);
+    if(h->detached && !h->joining)
+        free(h);
+}
+
+/* Removes a finished coroutine from its group. If the group becomes empty
+   everybody waiting in groupwait() is resumed. */
+static void mill_group_leave(struct mill_cr *cr) {
+    struct mill_group_ *g = cr->group;
+    mill_list_erase(&g->members, &cr->groupitem);
+    cr->group = NULL;
+    if(!mill_list_empty(&g->members))
+        return;
+    while(!mill_list_empty(&g->waiters))
+        mill_wakeup(mill_cont(mill_list_begin(&g->waiters), struct mill_cr,
+            waiter), 0);
+}
+
+/* The intial part of go(). Starts the new coroutine.
+   Returns the pointer to the top of its stack. */
+__attribute__((noinline)) dill_noopt
+void *mill_prologue_(const char *created) {
+    /* Ensure that debug functions are available whenever a single go()
+       statement is present in the user's code. */
+    mill_preserve_debug();
+    /* Allocate and initialise new stack. */
+    struct mill_cr *cr = mill_newcr(created);
     mill_trace(created, "{%d}=go()", (int)cr->debug.id);
     /* Suspend the parent coroutine and make the new one running. */
     mill_resume(mill_running, 0);    
@@ -191,6 +351,10 @@ void *mill_prologue_(const char *created) {
 __attribute__((noinline)) dill_noopt
 void mill_epilogue_(void) {
     mill_trace(NULL, "go() done");
+    if(mill_running->handle)
+        mill_gohandle_done(mill_running->handle);
+    if(mill_running->group)
+        mill_group_leave(mill_running);
     mill_unregister_cr(&mill_running->debug);
     if(mill_running->valbuf)
         free(mill_running->valbuf);
@@ -204,6 +368,274 @@ void mill_epilogue_(void) {
     mill_suspend();
 }
 
+/* Entry point of the coroutines launched by gomany(). The context of each
+   such coroutine is crafted in such a way that mill_ctxentry calls this
+   function with 'fn' and 'arg' taken from the context. */
+static __attribute__((noinline)) void mill_gomany_start(void (*fn)(void*),
+      void *arg) {
+    fn(arg);
+    mill_epilogue_();
+}
+
+void mill_gomany_(void (*fn)(void*), void *arg, int n, const char *created) {
+    mill_preserve_debug();
+    mill_trace(created, "gomany(%d)", n);
+    int i;
+    for(i = 0; i < n; ++i) {
+#if defined __x86_64__
+        /* Set up the new coroutine in such a way that it starts executing
+           mill_gomany_start() on its own stack once it is scheduled. The
+           parent keeps running; no context switch is done. */
+        struct mill_cr *cr = mill_newcr(created);
+        uint64_t *sp = (uint64_t*)((((uintptr_t)cr) - mill_valbuf_size) &
+            ~((uintptr_t)0xf));
+        /* mill_ctxentry is jumped into with rsp = 0 (mod 16) so that its call
+           enters mill_gomany_start() with the alignment the ABI expects. */
+        memset(cr->ctx, 0, sizeof(cr->ctx));
+        cr->ctx[MILL_CTX_R12] = (uint64_t)fn;
+        cr->ctx[MILL_CTX_R13] = (uint64_t)arg;
+        cr->ctx[MILL_CTX_R14] = (uint64_t)mill_gomany_start;
+        cr->ctx[MILL_CTX_RSP] = (uint64_t)sp;
+        cr->ctx[MILL_CTX_RIP] = (uint64_t)mill_ctxentry;
+        /* The new coroutine inherits floating point control settings
+           of its parent. */
+        __asm__("stmxcsr %0" : "=m" (((uint32_t*)&cr->ctx[MILL_CTX_FPU])[0]));
+        __asm__("fnstcw %0" : "=m" (((uint16_t*)&cr->ctx[MILL_CTX_FPU])[2]));
+        mill_trace(created, "{%d}=go()", (int)cr->debug.id);
+        mill_resume(cr, 0);
+#elif defined __aarch64__
+        /* Same as above. mill_ctxentry is "returned" into via the link
+           register. Stack pointer must be 16-byte aligned at all times. */
+        struct mill_cr *cr = mill_newcr(created);
+        uint64_t sp = (((uintptr_t)cr) - mill_valbuf_size) &
+            ~((uintptr_t)0xf);
+        memset(cr->ctx, 0, sizeof(cr->ctx));
+        cr->ctx[MILL_CTX_X19] = (uint64_t)fn;
+        cr->ctx[MILL_CTX_X20] = (uint64_t)arg;
+        cr->ctx[MILL_CTX_X21] = (uint64_t)mill_gomany_start;
+        cr->ctx[MILL_CTX_SP] = sp;
+        cr->ctx[MILL_CTX_LR] = (uint64_t)mill_ctxentry;
+        __asm__("mrs %0, fpcr" : "=r" (cr->ctx[MILL_CTX_FPU]));
+        mill_trace(created, "{%d}=go()", (int)cr->debug.id);
+        mill_resume(cr, 0);
+#else
+        /* There's no way to craft a context portably. Launch the coroutines
+           one by one, the same way go() does. */
+        void *mill_sp;
+        mill_ctx ctx = mill_getctx_();
+        if(!mill_setjmp_(ctx)) {
+            mill_sp = mill_prologue_(created);
+            int mill_anchor[mill_unoptimisable1_];
+            mill_unoptimisable2_ = &mill_anchor;
+            char mill_filler[(char*)&mill_anchor - (char*)(mill_sp)];
+            mill_unoptimisable2_ = &mill_filler;
+            mill_gomany_start(fn, arg);
+        }
+#endif
+    }
+}
+
+struct mill_gohandle_ *mill_gohandle_(void) {
+    mill_assert(!mill_nexthandle);
+    struct mill_gohandle_ *h = malloc(sizeof(struct mill_gohandle_));
+    if(mill_slow(!h))
+        mill_panic("not enough memory to allocate coroutine handle");
+    h->cr = NULL;
+    h->id = 0;
+    mill_list_init(&h->joiners);
+    h->joining = 0;
+    h->detached = 0;
+    mill_nexthandle = h;
+    return h;
+}
+
+int mill_gojoin_(struct mill_gohandle_ *h, int64_t deadline,
+      const char *current) {
+    if(mill_slow(!h))
+        mill_panic("null coroutine handle used");
+    mill_trace(current, "gojoin({%d})", h->id);
+    if(mill_slow(h->cr == mill_running))
+        mill_panic("coroutine is trying to join itself");
+    if(mill_slow(h->detached))
+        mill_panic("detached coroutine handle used");
+    ++h->joining;
+    if(h->cr) {
+        int rc = mill_waitfor(&h->joiners, MILL_JOIN, deadline, current);
+        if(rc < 0) {
+            /* The coroutine may have finished in the meantime. If so, and
+               the handle was detached, this is the last user of it. */
+            if(!--h->joining && !h->cr && h->detached)
+                free(h);
+            errno = rc == MILL_CANCELLED ? ECANCELED : ETIMEDOUT;
+            return -1;
+        }
+        mill_assert(!h->cr);
+    }
+    if(!--h->joining)
+        free(h);
+    errno = 0;
+    return 0;
+}
+
+void mill_godetach_(struct mill_gohandle_ *h, const char *current) {
+    if(mill_slow(!h))
+        mill_panic("null coroutine handle used");
+    mill_trace(current, "godetach({%d})", h->id);
+    if(mill_slow(h->detached))
+        mill_panic("coroutine handle detached twice");
+    /* Coroutines already in gojoin() will deallocate the handle. */
+    if(!h->cr && !h->joining) {
+        free(h);
+        return;
+    }
+    h->detached = 1;
+}
+
+void mill_gocancel_(struct mill_gohandle_ *h, const char *current) {
+    if(mill_slow(!h))
+        mill_panic("null coroutine handle used");
+    mill_trace(current, "gocancel({%d})", h->id);
+    /* If the coroutine have already finished there's nothing to do. */
+    if(h->cr)
+        mill_cancel(h->cr);
+}
+
+struct mill_group_ *mill_groupmake_(void) {
+    struct mill_group_ *g = malloc(sizeof(struct mill_group_));
+    if(mill_slow(!g))
+        return NULL;
+    mill_list_init(&g->members);
+    g->cancelled = 0;
+    mill_list_init(&g->waiters);
+    return g;
+}
+
+void mill_groupgo_(struct mill_group_ *g) {
+    if(mill_slow(!g))
+        mill_panic("null group used");
+    mill_assert(!mill_nextgroup);
+    mill_nextgroup = g;
+}
+
+void mill_groupcancel_(struct mill_group_ *g, const char *current) {
+    if(mill_slow(!g))
+        mill_panic("null group used");
+    mill_trace(current, "groupcancel()");
+    g->cancelled = 1;
+    /* Cancelling a coroutine doesn't remove it from the group, the group
+       is left only once the coroutine actually finishes. */
+    struct mill_list_item *it;
+    for(it = mill_list_begin(&g->members); it; it = mill_list_next(it))
+        mill_cancel(mill_cont(it, struct mill_cr, groupitem));
+}
+
+int mill_groupwait_(struct mill_group_ *g, int64_t deadline,
+      const char *current) {
+    if(mill_slow(!g))
+        mill_panic("null group used");
+    mill_trace(current, "groupwait()");
+    if(mill_slow(mill_running->group == g))
+        mill_panic("coroutine is waiting for its own group");
+    if(!mill_list_empty(&g->members)) {
+        int rc = mill_waitfor(&g->waiters, MILL_GROUPWAIT, deadline, current);
+        if(rc == -1) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if(rc == MILL_CANCELLED) {
+            errno = ECANCELED;
+            return -1;
+        }
+        mill_assert(mill_list_empty(&g->members));
+    }
+    errno = 0;
+    return 0;
+}
+
+void mill_groupclose_(struct mill_group_ *g, const char *current) {
+    if(mill_slow(!g))
+        mill_panic("null group used");
+    mill_trace(current, "groupclose()");
+    if(mill_slow(!mill_list_empty(&g->waiters)))
+        mill_panic("attempt to close a group while it is still being used");
+    /* Coroutines that are still running are cancelled and left to finish
+       on their own. */
+    mill_groupcancel_(g, current);
+    while(!mill_list_empty(&g->members)) {
+        struct mill_cr *cr = mill_cont(mill_list_begin(&g->members),
+            struct mill_cr, groupitem);
+        mill_list_erase(&g->members, &cr->groupitem);
+        cr->group = NULL;
+    }
+    free(g);
+}
+
+void mill_cancel(struct mill_cr *cr) {
+    cr->cancelled = 1;
+    /* If the coroutine is not blocked at the moment, it will find out about
+       the cancellation once it tries to do a blocking operation. */
+    if(cr == mill_running || cr->is_ready)
+        return;
+    /* Otherwise undo the blocking operation and unblock the coroutine. */
+    if(cr->waiters) {
+        mill_wakeup(cr, MILL_CANCELLED);
+        return;
+    }
+    switch(cr->state) {
+    case MILL_MSLEEP:
+    case MILL_FDWAIT:
+        mill_poller_cancel(cr);
+        break;
+    case MILL_CHR:
+    case MILL_CHS:
+    case MILL_CHOOSE:
+        mill_choose_cancel(cr);
+        break;
+    default:
+        mill_assert(0);
+    }
+    mill_resume(cr, MILL_CANCELLED);
+}
+
+static void mill_waitfor_callback(struct mill_timer *timer) {
+    struct mill_cr *cr = mill_cont(timer, struct mill_cr, timer);
+    mill_list_erase(cr->waiters, &cr->waiter);
+    cr->waiters = NULL;
+    mill_resume(cr, -1);
+}
+
+int mill_waitfor(struct mill_list *waiters, enum mill_state state,
+      int64_t deadline, const char *current) {
+    if(mill_slow(mill_running->cancelled))
+        return MILL_CANCELLED;
+    mill_running->state = state;
+    mill_set_current(&mill_running->debug, current);
+    mill_running->waiters = waiters;
+    mill_list_insert(waiters, &mill_running->waiter, NULL);
+    if(deadline >= 0)
+        mill_timer_add(&mill_running->timer, mill_ms2ns(deadline),
+            mill_waitfor_callback);
+    return mill_suspend();
+}
+
+void mill_wakeup(struct mill_cr *cr, int result) {
+    mill_assert(cr->waiters);
+    mill_list_erase(cr->waiters, &cr->waiter);
+    cr->waiters = NULL;
+    if(mill_timer_enabled(&cr->timer))
+        mill_timer_rm(&cr->timer);
+    mill_resume(cr, result);
+}
+
+void mill_requeue(struct mill_cr *cr, struct mill_list *waiters,
+      enum mill_state state) {
+    mill_assert(cr->waiters);
+    mill_list_erase(cr->waiters, &cr->waiter);
+    cr->waiters = waiters;
+    cr->state = state;
+    mill_list_insert(waiters, &cr->waiter, NULL);
+}
+
 void mill_yield_(const char *current) {
     mill_trace(current, "yield()");
     mill_set_current(&mill_running->debug, current);
@@ -229,7 +661,10 @@ void mill_setcls_(void *val) {
 }
 
 void mill_cr_postfork(void) {
-    /* Drop all coroutines in the "ready to execute" list. */
-    mill_slist_init(&mill_ready);
+    /* Drop all coroutines in the "ready to execute" lists. */
+    int i;
+    for(i = 0; i != MILL_NPRIOS; ++i)
+        mill_slist_init(&mill_ready[i]);
+    mill_ready_mask = 0;
 }
 
@@ -30,6 +30,7 @@
 
 #include "chan.h"
 #include "debug.h"
+#include "libmill.h"
 #include "list.h"
 #include "slist.h"
 #include "timer.h"
@@ -41,7 +42,56 @@ enum mill_state {
     MILL_FDWAIT,
     MILL_CHR,
     MILL_CHS,
-    MILL_CHOOSE
+    MILL_CHOOSE,
+    MILL_JOIN,
+    MILL_GROUPWAIT,
+    MILL_CHSETWAIT,
+    MILL_BCHR,
+    MILL_BCHPUB,
+    MILL_FUTWAIT,
+    MILL_MUTEXLOCK,
+    MILL_SEMWAIT,
+    MILL_WGWAIT,
+    MILL_CONDWAIT
+};
+
+/* Number of priority levels. 0 is the highest priority. */
+#define MILL_NPRIOS 4
+
+/* Priority the coroutines start with. */
+#define MILL_DEFAULT_PRIO 2
+
+/* Value passed to the blocked suspend() call when the coroutine is
+   cancelled. */
+#define MILL_CANCELLED (-2)
+
+/* Handle to a coroutine launched using goh(). Unlike the coroutine itself
+   the handle outlives the coroutine. It is deallocated by a successful
+   gojoin() or, if nobody is going to join the coroutine, by godetach(). */
+struct mill_gohandle_ {
+    /* The coroutine. NULL once it has finished. */
+    struct mill_cr *cr;
+    /* ID of the coroutine. Used for debugging purposes. */
+    int id;
+    /* Coroutines waiting in gojoin() for the coroutine to finish. */
+    struct mill_list joiners;
+    /* Number of coroutines in gojoin(), including those that were already
+       resumed but haven't run yet. The last one of them to leave gojoin()
+       deallocates the handle. */
+    int joining;
+    /* Set by godetach(). The handle is deallocated as soon as the coroutine
+       finishes and there's nobody joining it. */
+    int detached;
+};
+
+/* Group of coroutines. */
+struct mill_group_ {
+    /* List of coroutines in the group that haven't finished yet. */
+    struct mill_list members;
+    /* 1 if groupcancel() was already called, 0 otherwise. */
+    int cancelled;
+    /* Coroutines waiting in groupwait() for the group to become empty. */
+    struct mill_list waiters;
 };
 
 /* The coroutine. The memory layout looks like this:
@@ -66,6 +116,10 @@ struct mill_cr {
     int is_ready;
     struct mill_slist_item ready;
 
+    /* Priority of the coroutine. Determines which of the ready queues
+       the coroutine is stored in. */
+    int prio;
+
     /* If the coroutine is waiting for a deadline, it uses this timer. */
     struct mill_timer timer;
 
@@ -82,8 +136,8 @@ struct mill_cr {
     struct mill_choosedata choosedata;
 
     /* Stored coroutine context while it is not executing. */
-#if defined(__x86_64__)
-    uint64_t ctx[10];
+#if defined(__x86_64__) || defined(__aarch64__)
+    uint64_t ctx[MILL_CTX_SIZE];
 #else
     sigjmp_buf ctx;
 #endif
@@ -100,6 +154,23 @@ struct mill_cr {
     /* Coroutine-local storage. */
     void *clsval;
 
+    /* 1 if the coroutine was cancelled. Once cancelled, all the blocking
+       operations performed by the coroutine fail with ECANCELED. */
+    int cancelled;
+
+    /* The handle of the coroutine if it was launched using goh(),
+       NULL otherwise. */
+    struct mill_gohandle_ *handle;
+
+    /* The group the coroutine belongs to, NULL if none. */
+    struct mill_group_ *group;
+    struct mill_list_item groupitem;
+
+    /* If the coroutine is blocked in mill_waitfor(), the list of waiters
+       it is stored in. NULL otherwise. */
+    struct mill_list *waiters;
+    struct mill_list_item waiter;
+
 #if defined MILL_VALGRIND
     /* Valgrind stack identifier. */
     int sid;
@@ -115,6 +186,9 @@ extern struct mill_cr mill_main;
 /* The coroutine that is running at the moment. */
 extern struct mill_cr *mill_running;
 
+/* Statistics about checks for external events done by the scheduler. */
+extern struct mill_pollstats mill_stats;
+
 /* Suspend running coroutine. Move to executing different coroutines. Once
    someone resumes this coroutine using mill_resume function 'result' argument
    of that function will be returned. */
@@ -125,6 +199,25 @@ int mill_suspend(void);
    coroutines. */
 void mill_resume(struct mill_cr *cr, int result);
 
+/* Cancels the coroutine. If it is blocked, the blocking operation is undone
+   and the coroutine is scheduled for execution. */
+void mill_cancel(struct mill_cr *cr);
+
+/* Blocks the running coroutine in the supplied list of waiters till it is
+   woken up by mill_wakeup(). Returns the value passed to mill_wakeup(), -1
+   if the deadline expires or MILL_CANCELLED if the coroutine is cancelled. */
+int mill_waitfor(struct mill_list *waiters, enum mill_state state,
+    int64_t deadline, const char *current);
+
+/* Removes a coroutine blocked in mill_waitfor() from the list of waiters
+   and schedules it for execution. */
+void mill_wakeup(struct mill_cr *cr, int result);
+
+/* Moves a coroutine blocked in mill_waitfor() to a different list of waiters
+   without waking it up. The deadline, if any, remains in effect. */
+void mill_requeue(struct mill_cr *cr, struct mill_list *waiters,
+    enum mill_state state);
+
 /* Returns pointer to the value buffer. The returned buffer is guaranteed
    to be at least 'size' bytes long. */
 void *mill_valbuf(struct mill_cr *cr, size_t size);
@@ -133,4 +226,15 @@ void *mill_valbuf(struct mill_cr *cr, size_t size);
    inherited from the parent. */
 void mill_cr_postfork(void);
 
+#if defined(__x86_64__) || defined(__aarch64__)
+/* Stores the current context to 'from' and jumps to 'to'. Returns once some
+   other coroutine jumps back to 'from'. */
+void mill_ctxswap(uint64_t *from, uint64_t *to);
+
+/* Trampoline in ctx.c that contexts crafted by gomany() start executing in.
+   It calls function stored in R14 (X21) slot with arguments from R12 and R13
+   (X19 and X20). */
+void mill_ctxentry(void);
+#endif
+
 #endif
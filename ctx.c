@@ -0,0 +1,254 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include "libmill.h"
+
+#if defined __x86_64__ || defined __aarch64__
+
+/* When the library is built with indirect branch tracking (x86-64 IBT) or
+   branch target identification (aarch64 BTI) enabled, the compiler marks
+   the object file as compatible with it in the GNU property note. The asm
+   below then has to start each function with a landing pad and has to mark
+   the indirect jumps that resume a stored context, which land in the middle
+   of a function, as not tracked. */
+#if defined __x86_64__ && defined __CET__ && (__CET__ & 1)
+#define MILL_ASM_LANDING "    endbr64\n"
+#define MILL_ASM_NOTRACK "notrack "
+#elif defined __aarch64__ && defined __ARM_FEATURE_BTI_DEFAULT
+/* bti c. Encoded as a hint so that it's a no-op on older CPUs. On aarch64
+   contexts are resumed by returning, which is not subject to BTI. */
+#define MILL_ASM_LANDING "    hint    #34\n"
+#define MILL_ASM_NOTRACK ""
+#else
+#define MILL_ASM_LANDING ""
+#define MILL_ASM_NOTRACK ""
+#endif
+
+#if defined __APPLE__
+#define MILL_ASM_FN(name) \
+    ".globl _" #name "\n"\
+    ".p2align 4\n"\
+    "_" #name ":\n"\
+    MILL_ASM_LANDING
+#define MILL_ASM_HIDDEN(name) \
+    ".private_extern _" #name "\n"
+#define MILL_ASM_END(name)
+#else
+#define MILL_ASM_FN(name) \
+    ".globl " #name "\n"\
+    ".type " #name ", %function\n"\
+    ".p2align 4\n"\
+    #name ":\n"\
+    MILL_ASM_LANDING
+#define MILL_ASM_HIDDEN(name) \
+    ".hidden " #name "\n"
+#define MILL_ASM_END(name) \
+    ".size " #name ", .-" #name "\n"
+#endif
+
+#if defined __x86_64__
+
+/* Out-of-line context switch. Being a plain function call, the compiler
+   already assumes that everything but rbx, rbp, r12-r15 and rsp is clobbered
+   and keeps no live values in vector registers across it. There's thus
+   no need to save them. The control bits of MXCSR and x87 control word
+   are callee-saved as well, so they are stored in the last slot.
+
+   int mill_setjmp_(mill_ctx ctx) -- returns 0 when called, 1 when the
+   context is jumped back into.
+   void mill_longjmp_(mill_ctx ctx) -- never returns.
+   void mill_ctxswap(uint64_t *from, uint64_t *to) -- the two above fused
+   together, used by the scheduler so that a context switch is a single
+   call. Loading MXCSR and x87 control word is slow, so it's skipped when
+   both contexts have the same settings, which is almost always the case.
+
+   mill_ctxentry is where the contexts crafted by gomany() start executing:
+   it calls the function in r14 with arguments taken from r12 and r13. */
+__asm__(
+    ".text\n"
+    MILL_ASM_FN(mill_setjmp_)
+    "    movq    (%rsp), %rdx\n"
+    "    leaq    8(%rsp), %rcx\n"
+    "    movq    %rbx, 0(%rdi)\n"
+    "    movq    %rbp, 8(%rdi)\n"
+    "    movq    %r12, 16(%rdi)\n"
+    "    movq    %r13, 24(%rdi)\n"
+    "    movq    %r14, 32(%rdi)\n"
+    "    movq    %r15, 40(%rdi)\n"
+    "    movq    %rcx, 48(%rdi)\n"
+    "    movq    %rdx, 56(%rdi)\n"
+    "    stmxcsr 64(%rdi)\n"
+    "    fnstcw  68(%rdi)\n"
+    "    xorl    %eax, %eax\n"
+    "    ret\n"
+    MILL_ASM_END(mill_setjmp_)
+    MILL_ASM_FN(mill_longjmp_)
+    "    movq    0(%rdi), %rbx\n"
+    "    movq    8(%rdi), %rbp\n"
+    "    movq    16(%rdi), %r12\n"
+    "    movq    24(%rdi), %r13\n"
+    "    movq    32(%rdi), %r14\n"
+    "    movq    40(%rdi), %r15\n"
+    "    ldmxcsr 64(%rdi)\n"
+    "    fldcw   68(%rdi)\n"
+    "    movq    48(%rdi), %rsp\n"
+    "    movl    $1, %eax\n"
+    "    " MILL_ASM_NOTRACK "jmpq *56(%rdi)\n"
+    MILL_ASM_END(mill_longjmp_)
+    MILL_ASM_HIDDEN(mill_ctxswap)
+    MILL_ASM_FN(mill_ctxswap)
+    "    movq    (%rsp), %rdx\n"
+    "    leaq    8(%rsp), %rcx\n"
+    "    movq    %rbx, 0(%rdi)\n"
+    "    movq    %rbp, 8(%rdi)\n"
+    "    movq    %r12, 16(%rdi)\n"
+    "    movq    %r13, 24(%rdi)\n"
+    "    movq    %r14, 32(%rdi)\n"
+    "    movq    %r15, 40(%rdi)\n"
+    "    movq    %rcx, 48(%rdi)\n"
+    "    movq    %rdx, 56(%rdi)\n"
+    "    stmxcsr 64(%rdi)\n"
+    "    fnstcw  68(%rdi)\n"
+    "    movq    0(%rsi), %rbx\n"
+    "    movq    8(%rsi), %rbp\n"
+    "    movq    16(%rsi), %r12\n"
+    "    movq    24(%rsi), %r13\n"
+    "    movq    32(%rsi), %r14\n"
+    "    movq    40(%rsi), %r15\n"
+    "    movl    64(%rdi), %eax\n"
+    "    cmpl    64(%rsi), %eax\n"
+    "    jne     1f\n"
+    "    movzwl  68(%rdi), %eax\n"
+    "    cmpw    68(%rsi), %ax\n"
+    "    jne     1f\n"
+    "    movq    48(%rsi), %rsp\n"
+    "    movl    $1, %eax\n"
+    "    " MILL_ASM_NOTRACK "jmpq *56(%rsi)\n"
+    "1:  ldmxcsr 64(%rsi)\n"
+    "    fldcw   68(%rsi)\n"
+    "    movq    48(%rsi), %rsp\n"
+    "    movl    $1, %eax\n"
+    "    " MILL_ASM_NOTRACK "jmpq *56(%rsi)\n"
+    MILL_ASM_END(mill_ctxswap)
+    MILL_ASM_HIDDEN(mill_ctxentry)
+    MILL_ASM_FN(mill_ctxentry)
+    "    movq    %r12, %rdi\n"
+    "    movq    %r13, %rsi\n"
+    "    callq   *%r14\n"
+    "    ud2\n"
+    MILL_ASM_END(mill_ctxentry)
+);
+
+#elif defined __aarch64__
+
+/* Same as above, for AAPCS64. Callee-saved are x19-x28, frame pointer, link
+   register, stack pointer and the lower halves of v8-v15. The context is
+   resumed by returning to the saved link register. FPCR holds rounding mode
+   and the like and is restored only when it differs, as writing to it may
+   be expensive. */
+__asm__(
+    ".text\n"
+    MILL_ASM_FN(mill_setjmp_)
+    "    stp     x19, x20, [x0, #0]\n"
+    "    stp     x21, x22, [x0, #16]\n"
+    "    stp     x23, x24, [x0, #32]\n"
+    "    stp     x25, x26, [x0, #48]\n"
+    "    stp     x27, x28, [x0, #64]\n"
+    "    stp     x29, x30, [x0, #80]\n"
+    "    mov     x2, sp\n"
+    "    str     x2, [x0, #96]\n"
+    "    stp     d8, d9, [x0, #104]\n"
+    "    stp     d10, d11, [x0, #120]\n"
+    "    stp     d12, d13, [x0, #136]\n"
+    "    stp     d14, d15, [x0, #152]\n"
+    "    mrs     x2, fpcr\n"
+    "    str     x2, [x0, #168]\n"
+    "    mov     w0, #0\n"
+    "    ret\n"
+    MILL_ASM_END(mill_setjmp_)
+    MILL_ASM_FN(mill_longjmp_)
+    "    ldp     x19, x20, [x0, #0]\n"
+    "    ldp     x21, x22, [x0, #16]\n"
+    "    ldp     x23, x24, [x0, #32]\n"
+    "    ldp     x25, x26, [x0, #48]\n"
+    "    ldp     x27, x28, [x0, #64]\n"
+    "    ldp     x29, x30, [x0, #80]\n"
+    "    ldr     x2, [x0, #96]\n"
+    "    mov     sp, x2\n"
+    "    ldp     d8, d9, [x0, #104]\n"
+    "    ldp     d10, d11, [x0, #120]\n"
+    "    ldp     d12, d13, [x0, #136]\n"
+    "    ldp     d14, d15, [x0, #152]\n"
+    "    ldr     x2, [x0, #168]\n"
+    "    msr     fpcr, x2\n"
+    "    mov     w0, #1\n"
+    "    ret\n"
+    MILL_ASM_END(mill_longjmp_)
+    MILL_ASM_HIDDEN(mill_ctxswap)
+    MILL_ASM_FN(mill_ctxswap)
+    "    stp     x19, x20, [x0, #0]\n"
+    "    stp     x21, x22, [x0, #16]\n"
+    "    stp     x23, x24, [x0, #32]\n"
+    "    stp     x25, x26, [x0, #48]\n"
+    "    stp     x27, x28, [x0, #64]\n"
+    "    stp     x29, x30, [x0, #80]\n"
+    "    mov     x2, sp\n"
+    "    str     x2, [x0, #96]\n"
+    "    stp     d8, d9, [x0, #104]\n"
+    "    stp     d10, d11, [x0, #120]\n"
+    "    stp     d12, d13, [x0, #136]\n"
+    "    stp     d14, d15, [x0, #152]\n"
+    "    mrs     x2, fpcr\n"
+    "    str     x2, [x0, #168]\n"
+    "    ldp     x19, x20, [x1, #0]\n"
+    "    ldp     x21, x22, [x1, #16]\n"
+    "    ldp     x23, x24, [x1, #32]\n"
+    "    ldp     x25, x26, [x1, #48]\n"
+    "    ldp     x27, x28, [x1, #64]\n"
+    "    ldp     x29, x30, [x1, #80]\n"
+    "    ldr     x3, [x1, #96]\n"
+    "    mov     sp, x3\n"
+    "    ldp     d8, d9, [x1, #104]\n"
+    "    ldp     d10, d11, [x1, #120]\n"
+    "    ldp     d12, d13, [x1, #136]\n"
+    "    ldp     d14, d15, [x1, #152]\n"
+    "    ldr     x3, [x1, #168]\n"
+    "    cmp     x2, x3\n"
+    "    b.eq    1f\n"
+    "    msr     fpcr, x3\n"
+    "1:  mov     w0, #1\n"
+    "    ret\n"
+    MILL_ASM_END(mill_ctxswap)
+    MILL_ASM_HIDDEN(mill_ctxentry)
+    MILL_ASM_FN(mill_ctxentry)
+    "    mov     x0, x19\n"
+    "    mov     x1, x20\n"
+    "    blr     x21\n"
+    "    brk     #0\n"
+    MILL_ASM_END(mill_ctxentry)
+);
+
+#endif
+
+#endif
@@ -36,6 +36,22 @@
 #include "stack.h"
 #include "utils.h"
 
+void mill_panic(const char *text) {
+    fprintf(stderr, "panic: %s\n", text);
+    abort();
+}
+
+#if defined MILL_NDEBUG
+
+int mill_numcrs = 0;
+
+void goredump(void) {
+    fprintf(stderr,
+        "\ngoredump() is not available, libmill was built with MILL_NDEBUG\n\n");
+}
+
+#else
+
 /* ID to be assigned to next launched coroutine. */
 static int mill_next_cr_id = 1;
 
@@ -49,11 +65,6 @@ static int mill_next_chan_id = 1;
 /* List of all channels. */
 static struct mill_list mill_all_chans = {0};
 
-void mill_panic(const char *text) {
-    fprintf(stderr, "panic: %s\n", text);
-    abort();
-}
-
 void mill_register_cr(struct mill_debug_cr *cr, const char *created) {
     mill_list_insert(&mill_all_crs, &cr->item, NULL);
     cr->id = mill_next_cr_id;
@@ -108,6 +119,36 @@ void goredump(void) {
                 cr->events & FDW_IN ? "FDW_IN" :
                 cr->events & FDW_OUT ? "FDW_OUT" : 0);
             break;
+        case MILL_JOIN:
+            sprintf(buf, "gojoin()");
+            break;
+        case MILL_GROUPWAIT:
+            sprintf(buf, "groupwait()");
+            break;
+        case MILL_CHSETWAIT:
+            sprintf(buf, "chsetwait()");
+            break;
+        case MILL_BCHR:
+            sprintf(buf, "bchr()");
+            break;
+        case MILL_BCHPUB:
+            sprintf(buf, "bchpub()");
+            break;
+        case MILL_FUTWAIT:
+            sprintf(buf, "futwait()");
+            break;
+        case MILL_MUTEXLOCK:
+            sprintf(buf, "mutexlock()");
+            break;
+        case MILL_SEMWAIT:
+            sprintf(buf, "semwait()");
+            break;
+        case MILL_WGWAIT:
+            sprintf(buf, "wgwait()");
+            break;
+        case MILL_CONDWAIT:
+            sprintf(buf, "condwait()");
+            break;
         case MILL_CHR:
         case MILL_CHS:
         case MILL_CHOOSE:
@@ -145,6 +186,12 @@ void goredump(void) {
             cr->debug.created ? cr->debug.created : "<main>");
     }
     fprintf(stderr,"\n");
+    fprintf(stderr, "POLLS    switches: %llu  timeouts: %llu  idle: %llu  "
+        "busy: %llu\n\n",
+        (unsigned long long)mill_stats.switches,
+        (unsigned long long)mill_stats.timeouts,
+        (unsigned long long)mill_stats.idle,
+        (unsigned long long)mill_stats.busy);
 
     if(mill_list_empty(&mill_all_chans))
         return;
@@ -200,6 +247,8 @@ void goredump(void) {
     fprintf(stderr,"\n");
 }
 
+#endif
+
 int mill_tracelevel = 0;
 
 void gotrace(int level) {
@@ -245,8 +294,10 @@ void mill_preserve_debug(void) {
     gotrace(0);
 }
 
+#if !defined MILL_NDEBUG
 int mill_hascrs(void) {
     return (mill_all_crs.first == &mill_main.debug.item &&
         mill_all_crs.last == &mill_main.debug.item) ? 0 : 1;
 }
+#endif
 
@@ -54,6 +54,29 @@ void mill_panic(const char *text);
 /* No-op, but ensures that debugging functions get compiled into the binary. */
 void mill_preserve_debug(void);
 
+#if defined MILL_NDEBUG
+
+/* In MILL_NDEBUG builds coroutines and channels are not registered anywhere
+   and no tracing is done. The only thing tracked is the number of running
+   coroutines. */
+
+extern int mill_numcrs;
+
+#define mill_register_cr(cr, created) ((void)(created), ++mill_numcrs)
+#define mill_unregister_cr(cr) (--mill_numcrs)
+#define mill_register_chan(ch, created) ((void)(created))
+#define mill_unregister_chan(ch) ((void)0)
+#define mill_set_current(cr, current) ((void)(current))
+
+extern int mill_tracelevel;
+
+#define mill_trace if(0) mill_trace_
+void mill_trace_(const char *location, const char *format, ...);
+
+#define mill_hascrs() (mill_numcrs ? 1 : 0)
+
+#else
+
 /* (Un)register coroutines and channels with the debugging subsystem. */
 void mill_register_cr(struct mill_debug_cr *cr, const char *created);
 void mill_unregister_cr(struct mill_debug_cr *cr);
@@ -74,3 +97,5 @@ void mill_trace_(const char *location, const char *format, ...);
 int mill_hascrs(void);
 
 #endif
+
+#endif
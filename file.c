@@ -112,6 +112,8 @@ size_t mill_mfwrite_(struct mill_file *f, const void *buf, size_t len,
             if(errno != EAGAIN && errno != EWOULDBLOCK)
                 return 0;
             int rc = fdwait(f->fd, FDW_OUT, deadline);
+            if(rc < 0)
+                return len - remaining;
             if(rc == 0) {
                 errno = ETIMEDOUT;
                 return len - remaining;
@@ -138,6 +140,8 @@ void mill_mfflush_(struct mill_file *f, int64_t deadline) {
             if(errno != EAGAIN && errno != EWOULDBLOCK)
                 return;
             int rc = fdwait(f->fd, FDW_OUT, deadline);
+            if(rc < 0)
+                return;
             if(rc == 0) {
                 errno = ETIMEDOUT;
                 return;
@@ -229,6 +233,8 @@ size_t mill_mfread_(struct mill_file *f, void *buf, size_t len,
 
         /* Wait till there's more data to read. */
         int res = fdwait(f->fd, FDW_IN, deadline);
+        if(res < 0)
+            return len - remaining;
         if (!res) {
             errno = ETIMEDOUT;
             return len - remaining;
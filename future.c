@@ -0,0 +1,93 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <string.h>
+
+#include "cr.h"
+#include "libmill.h"
+#include "list.h"
+#include "utils.h"
+
+/* Single-use future. The result is written directly to the storage
+   supplied by the waiter so there's nothing to allocate and no value
+   to copy out once the waiter is resumed. If futwait() times out the
+   future stays pending and may still be set later on, thus both the future
+   and the destination must remain valid until futset() is called. */
+struct mill_future {
+    /* Coroutines blocked in futwait(). */
+    struct mill_list waiters;
+    /* Where to store the result. */
+    void *dst;
+    /* Size of the result, in bytes. */
+    size_t sz;
+    /* 1 if the result was already set. */
+    int done;
+};
+
+MILL_CT_ASSERT(sizeof(struct mill_future) <= sizeof(mill_future_));
+
+void mill_futinit_(mill_future_ *f, void *dst, size_t sz,
+      const char *current) {
+    struct mill_future *fut = (struct mill_future*)f;
+    mill_trace(current, "futinit()");
+    mill_list_init(&fut->waiters);
+    fut->dst = dst;
+    fut->sz = sz;
+    fut->done = 0;
+}
+
+void mill_futset_(mill_future_ *f, const void *val, size_t sz,
+      const char *current) {
+    struct mill_future *fut = (struct mill_future*)f;
+    mill_trace(current, "futset()");
+    if(mill_slow(fut->done))
+        mill_panic("future was already set");
+    if(mill_slow(fut->sz != sz))
+        mill_panic("set of a type not matching the future");
+    memcpy(fut->dst, val, sz);
+    fut->done = 1;
+    while(!mill_list_empty(&fut->waiters))
+        mill_wakeup(mill_cont(mill_list_begin(&fut->waiters), struct mill_cr,
+            waiter), 0);
+}
+
+int mill_futwait_(mill_future_ *f, int64_t deadline, const char *current) {
+    struct mill_future *fut = (struct mill_future*)f;
+    mill_trace(current, "futwait()");
+    if(!fut->done) {
+        int rc = mill_waitfor(&fut->waiters, MILL_FUTWAIT, deadline, current);
+        if(rc == -1) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if(rc == MILL_CANCELLED) {
+            errno = ECANCELED;
+            return -1;
+        }
+        mill_assert(fut->done);
+    }
+    errno = 0;
+    return 0;
+}
@@ -290,6 +290,8 @@ ipaddr mill_ipremote_(const char *name, int port, int mode, int64_t deadline) {
                in next iteration. We have to clean the fdwait cache here
                to be on the safe side. */
             fdclean(fd);
+            if(mill_slow(events < 0))
+                return addr;
             if(mill_slow(!events)) {
                 errno = ETIMEDOUT;
                 return addr;
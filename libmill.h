@@ -30,6 +30,9 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <unistd.h>
+#if defined MILL_INLINE
+#include <string.h>
+#endif
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -47,13 +50,13 @@ extern "C" {
 /*  www.gnu.org/software/libtool/manual/html_node/Updating-version-info.html  */
 
 /*  The current interface version. */
-#define MILL_VERSION_CURRENT 19
+#define MILL_VERSION_CURRENT 20
 
 /*  The latest revision of the current interface. */
-#define MILL_VERSION_REVISION 1
+#define MILL_VERSION_REVISION 0
 
 /*  How many past interface versions are still supported. */
-#define MILL_VERSION_AGE 1
+#define MILL_VERSION_AGE 0
 
 /******************************************************************************/
 /*  Symbol visibility                                                         */
@@ -96,14 +99,22 @@ extern "C" {
 
 MILL_EXPORT int64_t mill_now_(
     void);
+MILL_EXPORT int64_t mill_nowus_(
+    void);
+MILL_EXPORT int64_t mill_nowns_(
+    void);
 MILL_EXPORT pid_t mill_mfork_(
     void);
 
 #if defined MILL_USE_PREFIX
 #define mill_now mill_now_
+#define mill_nowus mill_nowus_
+#define mill_nowns mill_nowns_
 #define mill_mfork mill_mfork_
 #else
 #define now mill_now_
+#define nowus mill_nowus_
+#define nowns mill_nowns_
 #define mfork mill_mfork_
 #endif
 
@@ -118,12 +129,15 @@ MILL_EXPORT pid_t mill_mfork_(
 MILL_EXPORT extern volatile int mill_unoptimisable1_;
 MILL_EXPORT extern volatile void *mill_unoptimisable2_;
 
-#if defined __x86_64__
+#if defined __x86_64__ || defined __aarch64__
 typedef uint64_t *mill_ctx;
 #else
 typedef sigjmp_buf *mill_ctx;
 #endif
 
+struct mill_gohandle_;
+struct mill_group_;
+
 MILL_EXPORT mill_ctx mill_getctx_(
     void);
 MILL_EXPORT __attribute__((noinline)) void *mill_prologue_(
@@ -135,8 +149,66 @@ MILL_EXPORT void mill_goprepare_(
     int count,
     size_t stack_size,
     size_t val_size);
+MILL_EXPORT void mill_gomany_(
+    void (*fn)(void *arg),
+    void *arg,
+    int n,
+    const char *created);
 MILL_EXPORT void mill_yield_(
     const char *current);
+struct mill_pollstats {
+    /* Number of checks for external events forced by the number of
+       context switches done since the last check. */
+    uint64_t switches;
+    /* Number of checks forced by the time elapsed since the last check. */
+    uint64_t timeouts;
+    /* Number of blocking waits done because there was no coroutine
+       ready to run. */
+    uint64_t idle;
+    /* Number of those waits that were satisfied while busy polling. */
+    uint64_t busy;
+};
+
+MILL_EXPORT void mill_setpoll_(
+    int switches,
+    int64_t interval);
+MILL_EXPORT void mill_setbusypoll_(
+    int budget);
+MILL_EXPORT void mill_pollstats_(
+    struct mill_pollstats *stats);
+MILL_EXPORT int mill_setprio_(
+    int prio,
+    const char *current);
+MILL_EXPORT struct mill_gohandle_ *mill_gohandle_(
+    void);
+MILL_EXPORT int mill_gojoin_(
+    struct mill_gohandle_ *h,
+    int64_t deadline,
+    const char *current);
+MILL_EXPORT void mill_gocancel_(
+    struct mill_gohandle_ *h,
+    const char *current);
+MILL_EXPORT void mill_godetach_(
+    struct mill_gohandle_ *h,
+    const char *current);
+MILL_EXPORT struct mill_group_ *mill_groupmake_(
+    void);
+MILL_EXPORT void mill_groupgo_(
+    struct mill_group_ *g);
+MILL_EXPORT void mill_groupcancel_(
+    struct mill_group_ *g,
+    const char *current);
+MILL_EXPORT int mill_groupwait_(
+    struct mill_group_ *g,
+    int64_t deadline,
+    const char *current);
+MILL_EXPORT void mill_groupclose_(
+    struct mill_group_ *g,
+    const char *current);
+MILL_EXPORT void mill_settimerslack_(
+    int64_t slack);
+MILL_EXPORT int mill_setprecisetimers_(
+    int enable);
 MILL_EXPORT void mill_msleep_(
     int64_t deadline,
     const char *current);
@@ -145,6 +217,14 @@ MILL_EXPORT int mill_fdwait_(
     int events,
     int64_t deadline,
     const char *current);
+MILL_EXPORT void mill_msleepns_(
+    int64_t deadline,
+    const char *current);
+MILL_EXPORT int mill_fdwaitns_(
+    int fd,
+    int events,
+    int64_t deadline,
+    const char *current);
 MILL_EXPORT void mill_fdclean_(
     int fd);
 MILL_EXPORT void *mill_cls_(
@@ -154,52 +234,43 @@ MILL_EXPORT void mill_setcls_(
 
 
 #if defined(__x86_64__)
-#if defined(__AVX__)
-#define MILL_CLOBBER \
-        , "ymm0", "ymm1", "ymm2", "ymm3", "ymm4", "ymm5", "ymm6", "ymm7",\
-        "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15"
-#else
-#define MILL_CLOBBER
+/* Layout of the context saved by mill_setjmp_() and restored by
+   mill_longjmp_(), in 8-byte slots. The asm in ctx.c must stay in sync.
+   Only the registers the SysV ABI requires a callee to preserve are stored;
+   everything else, including all the vector registers, is already treated
+   as clobbered by the caller of an ordinary function. The last slot holds
+   MXCSR in its lower and x87 control word in its upper half. gomany() relies
+   on the layout to craft contexts of new coroutines. */
+#define MILL_CTX_RBX 0
+#define MILL_CTX_RBP 1
+#define MILL_CTX_R12 2
+#define MILL_CTX_R13 3
+#define MILL_CTX_R14 4
+#define MILL_CTX_R15 5
+#define MILL_CTX_RSP 6
+#define MILL_CTX_RIP 7
+#define MILL_CTX_FPU 8
+#define MILL_CTX_SIZE 9
+#elif defined(__aarch64__)
+/* Same as above for AAPCS64: x19-x28, frame pointer, link register, which
+   doubles as the address to resume at, stack pointer, the lower halves of
+   v8-v15 and FPCR. */
+#define MILL_CTX_X19 0
+#define MILL_CTX_X20 1
+#define MILL_CTX_X21 2
+#define MILL_CTX_FP 10
+#define MILL_CTX_LR 11
+#define MILL_CTX_SP 12
+#define MILL_CTX_D8 13
+#define MILL_CTX_FPU 21
+#define MILL_CTX_SIZE 22
 #endif
-#define mill_setjmp_(ctx) ({\
-    int ret;\
-    asm("lea     LJMPRET%=(%%rip), %%rcx\n\t"\
-        "xor     %%rax, %%rax\n\t"\
-        "mov     %%rbx, (%%rdx)\n\t"\
-        "mov     %%rbp, 8(%%rdx)\n\t"\
-        "mov     %%r12, 16(%%rdx)\n\t"\
-        "mov     %%rsp, 24(%%rdx)\n\t"\
-        "mov     %%r13, 32(%%rdx)\n\t"\
-        "mov     %%r14, 40(%%rdx)\n\t"\
-        "mov     %%r15, 48(%%rdx)\n\t"\
-        "mov     %%rcx, 56(%%rdx)\n\t"\
-        "mov     %%rdi, 64(%%rdx)\n\t"\
-        "mov     %%rsi, 72(%%rdx)\n\t"\
-        "LJMPRET%=:\n\t"\
-        : "=a" (ret)\
-        : "d" (ctx)\
-        : "memory", "rcx", "r8", "r9", "r10", "r11",\
-          "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",\
-          "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15"\
-          MILL_CLOBBER\
-          );\
-    ret;\
-})
-#define mill_longjmp_(ctx) \
-    asm("movq   (%%rax), %%rbx\n\t"\
-	    "movq   8(%%rax), %%rbp\n\t"\
-	    "movq   16(%%rax), %%r12\n\t"\
-	    "movq   24(%%rax), %%rdx\n\t"\
-	    "movq   32(%%rax), %%r13\n\t"\
-	    "movq   40(%%rax), %%r14\n\t"\
-	    "mov    %%rdx, %%rsp\n\t"\
-	    "movq   48(%%rax), %%r15\n\t"\
-	    "movq   56(%%rax), %%rdx\n\t"\
-	    "movq   64(%%rax), %%rdi\n\t"\
-	    "movq   72(%%rax), %%rsi\n\t"\
-	    "jmp    *%%rdx\n\t"\
-        : : "a" (ctx) : "rdx" \
-    )
+
+#if defined(__x86_64__) || defined(__aarch64__)
+MILL_EXPORT __attribute__((returns_twice)) int mill_setjmp_(
+    mill_ctx ctx);
+MILL_EXPORT __attribute__((noreturn)) void mill_longjmp_(
+    mill_ctx ctx);
 #else
 #define mill_setjmp_(ctx) \
     sigsetjmp(*ctx, 0)
@@ -222,16 +293,49 @@ MILL_EXPORT void mill_setcls_(
         }\
     } while(0)
 
+#define mill_goh_(fn) \
+    ({\
+        struct mill_gohandle_ *mill_h = mill_gohandle_();\
+        mill_go_(fn);\
+        mill_h;\
+    })
+
+#define mill_groupgo__(g, fn) \
+    do {\
+        mill_groupgo_(g);\
+        mill_go_(fn);\
+    } while(0)
+
 #if defined MILL_USE_PREFIX
 #define MILL_FDW_IN MILL_FDW_IN_
 #define MILL_FDW_OUT MILL_FDW_OUT_
 #define MILL_FDW_ERR MILL_FDW_ERR_
 #define mill_coroutine __attribute__((noinline))
+typedef struct mill_gohandle_ *mill_gohandle;
 #define mill_go(fn) mill_go_(fn)
+#define mill_goh(fn) mill_goh_(fn)
+#define mill_gojoin(h, dd) mill_gojoin_((h), (dd), MILL_HERE_)
+#define mill_gocancel(h) mill_gocancel_((h), MILL_HERE_)
+#define mill_godetach(h) mill_godetach_((h), MILL_HERE_)
+typedef struct mill_group_ *mill_group;
+#define mill_groupmake mill_groupmake_
+#define mill_groupgo(g, fn) mill_groupgo__((g), fn)
+#define mill_groupcancel(g) mill_groupcancel_((g), MILL_HERE_)
+#define mill_groupwait(g, dd) mill_groupwait_((g), (dd), MILL_HERE_)
+#define mill_groupclose(g) mill_groupclose_((g), MILL_HERE_)
 #define mill_goprepare mill_goprepare_
+#define mill_setpoll mill_setpoll_
+#define mill_setbusypoll mill_setbusypoll_
+#define mill_pollstats mill_pollstats_
+#define mill_gomany(fn, arg, n) mill_gomany_((fn), (arg), (n), MILL_HERE_)
 #define mill_yield() mill_yield_(MILL_HERE_)
+#define mill_setprio(prio) mill_setprio_((prio), MILL_HERE_)
+#define mill_settimerslack mill_settimerslack_
+#define mill_setprecisetimers mill_setprecisetimers_
 #define mill_msleep(dd) mill_msleep_((dd), MILL_HERE_)
 #define mill_fdwait(fd, ev, dd) mill_fdwait_((fd), (ev), (dd), MILL_HERE_)
+#define mill_msleepns(dd) mill_msleepns_((dd), MILL_HERE_)
+#define mill_fdwaitns(fd, ev, dd) mill_fdwaitns_((fd), (ev), (dd), MILL_HERE_)
 #define mill_fdclean mill_fdclean_
 #define mill_cls mill_cls_
 #define mill_setcls mill_setcls_
@@ -240,11 +344,31 @@ MILL_EXPORT void mill_setcls_(
 #define FDW_OUT MILL_FDW_OUT_
 #define FDW_ERR MILL_FDW_ERR_
 #define coroutine __attribute__((noinline))
+typedef struct mill_gohandle_ *gohandle;
 #define go(fn) mill_go_(fn)
+#define goh(fn) mill_goh_(fn)
+#define gojoin(h, dd) mill_gojoin_((h), (dd), MILL_HERE_)
+#define gocancel(h) mill_gocancel_((h), MILL_HERE_)
+#define godetach(h) mill_godetach_((h), MILL_HERE_)
+typedef struct mill_group_ *group;
+#define groupmake mill_groupmake_
+#define groupgo(g, fn) mill_groupgo__((g), fn)
+#define groupcancel(g) mill_groupcancel_((g), MILL_HERE_)
+#define groupwait(g, dd) mill_groupwait_((g), (dd), MILL_HERE_)
+#define groupclose(g) mill_groupclose_((g), MILL_HERE_)
 #define goprepare mill_goprepare_
+#define setpoll mill_setpoll_
+#define setbusypoll mill_setbusypoll_
+#define pollstats mill_pollstats_
+#define gomany(fn, arg, n) mill_gomany_((fn), (arg), (n), MILL_HERE_)
 #define yield() mill_yield_(MILL_HERE_)
+#define setprio(prio) mill_setprio_((prio), MILL_HERE_)
+#define settimerslack mill_settimerslack_
+#define setprecisetimers mill_setprecisetimers_
 #define msleep(deadline) mill_msleep_((deadline), MILL_HERE_)
 #define fdwait(fd, ev, dd) mill_fdwait_((fd), (ev), (dd), MILL_HERE_)
+#define msleepns(dd) mill_msleepns_((dd), MILL_HERE_)
+#define fdwaitns(fd, ev, dd) mill_fdwaitns_((fd), (ev), (dd), MILL_HERE_)
 #define fdclean mill_fdclean_
 #define cls mill_cls_
 #define setcls mill_setcls_
@@ -260,10 +384,40 @@ typedef struct{void *f1; void *f2; void *f3; void *f4;
     void *f5; void *f6; int f7; int f8; int f9;} mill_clause_;
 #define MILL_CLAUSELEN_ (sizeof(mill_clause_))
 
+/* The beginning of the channel structure. It is used by the inline fast
+   paths enabled by MILL_INLINE. */
+struct mill_chanhdr_ {
+    size_t sz;
+    char *buf;
+    size_t bufsz;
+    size_t mask;
+    size_t items;
+    size_t first;
+    int slow;
+};
+
 MILL_EXPORT struct mill_chan_ *mill_chmake_(
     size_t sz,
     size_t bufsz,
     const char *created);
+MILL_EXPORT struct mill_chan_ *mill_chmakep_(
+    size_t msgsz,
+    size_t bufsz,
+    const char *created);
+MILL_EXPORT void *mill_challoc_(
+    struct mill_chan_ *ch);
+MILL_EXPORT void mill_chfree_(
+    void *ptr);
+MILL_EXPORT struct mill_chan_ *mill_chticker_(
+    int64_t period,
+    const char *created);
+MILL_EXPORT struct mill_chan_ *mill_chafter_(
+    int64_t deadline,
+    const char *created);
+MILL_EXPORT struct mill_chan_ *mill_chlimiter_(
+    int64_t rate,
+    size_t burst,
+    const char *created);
 MILL_EXPORT struct mill_chan_ *mill_chdup_(
     struct mill_chan_ *ch,
     const char *created);
@@ -279,6 +433,11 @@ MILL_EXPORT void *mill_chr_(
     struct mill_chan_ *ch,
     size_t sz,
     const char *current);
+MILL_EXPORT int mill_chrto_(
+    struct mill_chan_ *ch,
+    void *dst,
+    size_t sz,
+    const char *current);
 MILL_EXPORT void mill_chdone_(
     struct mill_chan_ *ch,
     void *val,
@@ -306,6 +465,58 @@ MILL_EXPORT int mill_choose_wait_(
 MILL_EXPORT void *mill_choose_val_(
     size_t sz);
 
+#if defined MILL_INLINE
+
+/* If MILL_INLINE is defined, sending to a buffered channel with free space
+   and receiving from a non-empty buffer are done inline, without calling
+   into the library. Whenever the fast path doesn't apply, e.g. because
+   there are coroutines blocked on the channel or because the channel
+   is in a channel set, the library function is called. Operations done
+   on the fast path are not traced by gotrace().
+   Note that unlike the library functions, which always give other
+   coroutines a chance to run, an operation done on the fast path doesn't
+   yield. A loop that keeps sending to a channel that never fills up, or
+   receiving from one that never gets empty, will thus starve the other
+   coroutines. Such loops should call yield() explicitly. */
+
+static inline void mill_chs_inline_(struct mill_chan_ *ch, void *val,
+      size_t sz, const char *current) {
+    struct mill_chanhdr_ *hdr = (struct mill_chanhdr_*)ch;
+    if(hdr && !hdr->slow && hdr->sz == sz && hdr->items < hdr->bufsz) {
+        memcpy(hdr->buf + ((hdr->first + hdr->items) & hdr->mask) * sz,
+            val, sz);
+        ++hdr->items;
+        errno = 0;
+        return;
+    }
+    mill_chs_(ch, val, sz, current);
+}
+
+static inline void *mill_chr_inline_(struct mill_chan_ *ch, size_t sz,
+      const char *current) {
+    struct mill_chanhdr_ *hdr = (struct mill_chanhdr_*)ch;
+    if(hdr && !hdr->slow && hdr->sz == sz && hdr->items) {
+        /* The slot remains intact until the next send to the channel. */
+        void *val = hdr->buf + hdr->first * sz;
+        hdr->first = (hdr->first + 1) & hdr->mask;
+        --hdr->items;
+        errno = 0;
+        return val;
+    }
+    return mill_chr_(ch, sz, current);
+}
+
+#define mill_chs__(channel, type, value) \
+    do {\
+        type mill_val = (value);\
+        mill_chs_inline_((channel), &mill_val, sizeof(type), MILL_HERE_);\
+    } while(0)
+
+#define mill_chr__(channel, type) \
+    (*(type*)mill_chr_inline_((channel), sizeof(type), MILL_HERE_))
+
+#else
+
 #define mill_chs__(channel, type, value) \
     do {\
         type mill_val = (value);\
@@ -315,6 +526,13 @@ MILL_EXPORT void *mill_choose_val_(
 #define mill_chr__(channel, type) \
     (*(type*)mill_chr_((channel), sizeof(type), MILL_HERE_))
 
+#endif
+
+/* The conditional expression makes the compiler check that 'dest' points
+   to 'type'. */
+#define mill_chrto__(channel, type, dest) \
+    mill_chrto_((channel), (1 ? (dest) : (type*)0), sizeof(type), MILL_HERE_)
+
 #define mill_chdone__(channel, type, value) \
     do {\
         type mill_val = (value);\
@@ -395,16 +613,54 @@ MILL_EXPORT void *mill_choose_val_(
                     break;\
                 }\
             }\
+            if(mill_idx != -2)\
+                break;\
             mill_idx = mill_choose_wait_();\
         }
 
+#define MILL_CHOOSE_RANDOM_ 0
+#define MILL_CHOOSE_ROUNDROBIN_ 1
+
+MILL_EXPORT int mill_choosemode_(
+    int mode,
+    uint64_t seed);
+
+struct mill_chset_;
+
+MILL_EXPORT struct mill_chset_ *mill_chsetmake_(
+    void);
+MILL_EXPORT int mill_chsetadd_(
+    struct mill_chset_ *s,
+    struct mill_chan_ *ch,
+    const char *current);
+MILL_EXPORT int mill_chsetrm_(
+    struct mill_chset_ *s,
+    struct mill_chan_ *ch,
+    const char *current);
+MILL_EXPORT int mill_chsetwait_(
+    struct mill_chset_ *s,
+    struct mill_chan_ **chans,
+    int nchans,
+    int64_t deadline,
+    const char *current);
+MILL_EXPORT void mill_chsetclose_(
+    struct mill_chset_ *s,
+    const char *current);
+
 #if defined MILL_USE_PREFIX
 typedef struct mill_chan_ *mill_chan;
 #define mill_chmake(tp, sz) mill_chmake_(sizeof(tp), sz, MILL_HERE_)
+#define mill_chmakep(tp, sz) mill_chmakep_(sizeof(tp), sz, MILL_HERE_)
+#define mill_challoc mill_challoc_
+#define mill_chfree mill_chfree_
+#define mill_chticker(period) mill_chticker_((period), MILL_HERE_)
+#define mill_chafter(dd) mill_chafter_((dd), MILL_HERE_)
+#define mill_chlimiter(rate, burst) mill_chlimiter_((rate), (burst), MILL_HERE_)
 #define mill_chdup(ch) mill_chdup_((ch), MILL_HERE_)
 #define mill_chclose(ch) mill_chclose_((ch), MILL_HERE_)
 #define mill_chs(ch, tp, val) mill_chs__((ch), tp, (val))
 #define mill_chr(ch, tp) mill_chr__((ch), tp)
+#define mill_chrto(ch, tp, dst) mill_chrto__((ch), tp, (dst))
 #define mill_chdone(ch, tp, val) mill_chdone__((ch), tp, (val))
 #define mill_choose mill_choose_init__
 #define mill_in(ch, tp, nm) mill_choose_in__((ch), tp, nm, __COUNTER__)
@@ -412,13 +668,30 @@ typedef struct mill_chan_ *mill_chan;
 #define mill_deadline(dd) mill_choose_deadline__(dd, __COUNTER__)
 #define mill_otherwise mill_choose_otherwise__(__COUNTER__)
 #define mill_end mill_choose_end__
+#define MILL_CHOOSE_RANDOM MILL_CHOOSE_RANDOM_
+#define MILL_CHOOSE_ROUNDROBIN MILL_CHOOSE_ROUNDROBIN_
+#define mill_choosemode mill_choosemode_
+typedef struct mill_chset_ *mill_chset;
+#define mill_chsetmake mill_chsetmake_
+#define mill_chsetadd(s, ch) mill_chsetadd_((s), (ch), MILL_HERE_)
+#define mill_chsetrm(s, ch) mill_chsetrm_((s), (ch), MILL_HERE_)
+#define mill_chsetwait(s, chans, n, dd) \
+    mill_chsetwait_((s), (chans), (n), (dd), MILL_HERE_)
+#define mill_chsetclose(s) mill_chsetclose_((s), MILL_HERE_)
 #else
 typedef struct mill_chan_ *chan;
 #define chmake(tp, sz) mill_chmake_(sizeof(tp), sz, MILL_HERE_)
+#define chmakep(tp, sz) mill_chmakep_(sizeof(tp), sz, MILL_HERE_)
+#define challoc mill_challoc_
+#define chfree mill_chfree_
+#define chticker(period) mill_chticker_((period), MILL_HERE_)
+#define chafter(dd) mill_chafter_((dd), MILL_HERE_)
+#define chlimiter(rate, burst) mill_chlimiter_((rate), (burst), MILL_HERE_)
 #define chdup(ch) mill_chdup_((ch), MILL_HERE_)
 #define chclose(ch) mill_chclose_((ch), MILL_HERE_)
 #define chs(ch, tp, val) mill_chs__((ch), tp, (val))
 #define chr(ch, tp) mill_chr__((ch), tp)
+#define chrto(ch, tp, dst) mill_chrto__((ch), tp, (dst))
 #define chdone(ch, tp, val) mill_chdone__((ch), tp, (val))
 #define choose mill_choose_init__
 #define in(ch, tp, nm) mill_choose_in__((ch), tp, nm, __COUNTER__)
@@ -426,6 +699,225 @@ typedef struct mill_chan_ *chan;
 #define deadline(dd) mill_choose_deadline__(dd, __COUNTER__)
 #define otherwise mill_choose_otherwise__(__COUNTER__)
 #define end mill_choose_end__
+#define CHOOSE_RANDOM MILL_CHOOSE_RANDOM_
+#define CHOOSE_ROUNDROBIN MILL_CHOOSE_ROUNDROBIN_
+#define choosemode mill_choosemode_
+typedef struct mill_chset_ *chset;
+#define chsetmake mill_chsetmake_
+#define chsetadd(s, ch) mill_chsetadd_((s), (ch), MILL_HERE_)
+#define chsetrm(s, ch) mill_chsetrm_((s), (ch), MILL_HERE_)
+#define chsetwait(s, chans, n, dd) \
+    mill_chsetwait_((s), (chans), (n), (dd), MILL_HERE_)
+#define chsetclose(s) mill_chsetclose_((s), MILL_HERE_)
+#endif
+
+/******************************************************************************/
+/*  Broadcast channels                                                        */
+/******************************************************************************/
+
+#define MILL_BCH_DROP_ 0
+#define MILL_BCH_BLOCK_ 1
+
+struct mill_bchan_;
+struct mill_bchsub_;
+
+MILL_EXPORT struct mill_bchan_ *mill_bchmake_(
+    size_t sz,
+    size_t cap,
+    int policy,
+    const char *created);
+MILL_EXPORT struct mill_bchsub_ *mill_bchsubscribe_(
+    struct mill_bchan_ *b,
+    const char *current);
+MILL_EXPORT void mill_bchunsubscribe_(
+    struct mill_bchsub_ *s,
+    const char *current);
+MILL_EXPORT void mill_bchpub_(
+    struct mill_bchan_ *b,
+    void *val,
+    size_t sz,
+    const char *current);
+MILL_EXPORT void *mill_bchr_(
+    struct mill_bchsub_ *s,
+    size_t sz,
+    const char *current);
+MILL_EXPORT uint64_t mill_bchmissed_(
+    struct mill_bchsub_ *s);
+MILL_EXPORT void mill_bchclose_(
+    struct mill_bchan_ *b,
+    const char *current);
+
+#define mill_bchpub__(b, type, value) \
+    do {\
+        type mill_val = (value);\
+        mill_bchpub_((b), &mill_val, sizeof(type), MILL_HERE_);\
+    } while(0)
+
+#define mill_bchr__(s, type) \
+    (*(type*)mill_bchr_((s), sizeof(type), MILL_HERE_))
+
+#if defined MILL_USE_PREFIX
+#define MILL_BCH_DROP MILL_BCH_DROP_
+#define MILL_BCH_BLOCK MILL_BCH_BLOCK_
+typedef struct mill_bchan_ *mill_bchan;
+typedef struct mill_bchsub_ *mill_bchsub;
+#define mill_bchmake(tp, cap, policy) \
+    mill_bchmake_(sizeof(tp), (cap), (policy), MILL_HERE_)
+#define mill_bchsubscribe(b) mill_bchsubscribe_((b), MILL_HERE_)
+#define mill_bchunsubscribe(s) mill_bchunsubscribe_((s), MILL_HERE_)
+#define mill_bchpub(b, tp, val) mill_bchpub__((b), tp, (val))
+#define mill_bchr(s, tp) mill_bchr__((s), tp)
+#define mill_bchmissed mill_bchmissed_
+#define mill_bchclose(b) mill_bchclose_((b), MILL_HERE_)
+#else
+#define BCH_DROP MILL_BCH_DROP_
+#define BCH_BLOCK MILL_BCH_BLOCK_
+typedef struct mill_bchan_ *bchan;
+typedef struct mill_bchsub_ *bchsub;
+#define bchmake(tp, cap, policy) \
+    mill_bchmake_(sizeof(tp), (cap), (policy), MILL_HERE_)
+#define bchsubscribe(b) mill_bchsubscribe_((b), MILL_HERE_)
+#define bchunsubscribe(s) mill_bchunsubscribe_((s), MILL_HERE_)
+#define bchpub(b, tp, val) mill_bchpub__((b), tp, (val))
+#define bchr(s, tp) mill_bchr__((s), tp)
+#define bchmissed mill_bchmissed_
+#define bchclose(b) mill_bchclose_((b), MILL_HERE_)
+#endif
+
+/******************************************************************************/
+/*  Futures                                                                   */
+/******************************************************************************/
+
+/* Storage for a single-use future. It is allocated by the user, typically
+   on the stack of the coroutine waiting for the result. */
+typedef struct {void *f1; void *f2; void *f3; size_t f4; int f5;} mill_future_;
+
+MILL_EXPORT void mill_futinit_(
+    mill_future_ *f,
+    void *dst,
+    size_t sz,
+    const char *current);
+MILL_EXPORT void mill_futset_(
+    mill_future_ *f,
+    const void *val,
+    size_t sz,
+    const char *current);
+MILL_EXPORT int mill_futwait_(
+    mill_future_ *f,
+    int64_t deadline,
+    const char *current);
+
+#define mill_futset__(f, type, value) \
+    do {\
+        type mill_val = (value);\
+        mill_futset_((f), &mill_val, sizeof(type), MILL_HERE_);\
+    } while(0)
+
+#if defined MILL_USE_PREFIX
+typedef mill_future_ mill_future;
+#define mill_futinit(f, dst) mill_futinit_((f), (dst), sizeof(*(dst)), MILL_HERE_)
+#define mill_futset(f, tp, val) mill_futset__((f), tp, (val))
+#define mill_futwait(f, dd) mill_futwait_((f), (dd), MILL_HERE_)
+#else
+typedef mill_future_ future;
+#define futinit(f, dst) mill_futinit_((f), (dst), sizeof(*(dst)), MILL_HERE_)
+#define futset(f, tp, val) mill_futset__((f), tp, (val))
+#define futwait(f, dd) mill_futwait_((f), (dd), MILL_HERE_)
+#endif
+
+/******************************************************************************/
+/*  Synchronisation primitives                                                */
+/******************************************************************************/
+
+/* Storage for the synchronisation primitives. The objects are allocated
+   by the user, either statically, on the stack or embedded in other
+   structures, and have to be initialised before use. */
+typedef struct {void *f1; void *f2; void *f3;} mill_mutex_;
+typedef struct {void *f1; void *f2; int f3;} mill_sem_;
+typedef struct {void *f1; void *f2; int f3;} mill_wg_;
+typedef struct {void *f1; void *f2; void *f3;} mill_cond_;
+
+MILL_EXPORT void mill_mutexinit_(
+    mill_mutex_ *m);
+MILL_EXPORT int mill_mutexlock_(
+    mill_mutex_ *m,
+    int64_t deadline,
+    const char *current);
+MILL_EXPORT void mill_mutexunlock_(
+    mill_mutex_ *m,
+    const char *current);
+MILL_EXPORT void mill_seminit_(
+    mill_sem_ *s,
+    int count);
+MILL_EXPORT int mill_semwait_(
+    mill_sem_ *s,
+    int64_t deadline,
+    const char *current);
+MILL_EXPORT void mill_sempost_(
+    mill_sem_ *s,
+    const char *current);
+MILL_EXPORT void mill_wginit_(
+    mill_wg_ *wg);
+MILL_EXPORT void mill_wgadd_(
+    mill_wg_ *wg,
+    int n,
+    const char *current);
+MILL_EXPORT int mill_wgwait_(
+    mill_wg_ *wg,
+    int64_t deadline,
+    const char *current);
+MILL_EXPORT void mill_condinit_(
+    mill_cond_ *c);
+MILL_EXPORT int mill_condwait_(
+    mill_cond_ *c,
+    mill_mutex_ *m,
+    int64_t deadline,
+    const char *current);
+MILL_EXPORT void mill_condsignal_(
+    mill_cond_ *c,
+    const char *current);
+MILL_EXPORT void mill_condbroadcast_(
+    mill_cond_ *c,
+    const char *current);
+
+#if defined MILL_USE_PREFIX
+typedef mill_mutex_ mill_mutex;
+typedef mill_sem_ mill_sem;
+typedef mill_wg_ mill_wg;
+typedef mill_cond_ mill_cond;
+#define mill_mutexinit mill_mutexinit_
+#define mill_mutexlock(m, dd) mill_mutexlock_((m), (dd), MILL_HERE_)
+#define mill_mutexunlock(m) mill_mutexunlock_((m), MILL_HERE_)
+#define mill_seminit mill_seminit_
+#define mill_semwait(s, dd) mill_semwait_((s), (dd), MILL_HERE_)
+#define mill_sempost(s) mill_sempost_((s), MILL_HERE_)
+#define mill_wginit mill_wginit_
+#define mill_wgadd(wg, n) mill_wgadd_((wg), (n), MILL_HERE_)
+#define mill_wgdone(wg) mill_wgadd_((wg), -1, MILL_HERE_)
+#define mill_wgwait(wg, dd) mill_wgwait_((wg), (dd), MILL_HERE_)
+#define mill_condinit mill_condinit_
+#define mill_condwait(c, m, dd) mill_condwait_((c), (m), (dd), MILL_HERE_)
+#define mill_condsignal(c) mill_condsignal_((c), MILL_HERE_)
+#define mill_condbroadcast(c) mill_condbroadcast_((c), MILL_HERE_)
+#else
+typedef mill_mutex_ mutex;
+typedef mill_sem_ sem;
+typedef mill_wg_ wg;
+typedef mill_cond_ cond;
+#define mutexinit mill_mutexinit_
+#define mutexlock(m, dd) mill_mutexlock_((m), (dd), MILL_HERE_)
+#define mutexunlock(m) mill_mutexunlock_((m), MILL_HERE_)
+#define seminit mill_seminit_
+#define semwait(s, dd) mill_semwait_((s), (dd), MILL_HERE_)
+#define sempost(s) mill_sempost_((s), MILL_HERE_)
+#define wginit mill_wginit_
+#define wgadd(wg, n) mill_wgadd_((wg), (n), MILL_HERE_)
+#define wgdone(wg) mill_wgadd_((wg), -1, MILL_HERE_)
+#define wgwait(wg, dd) mill_wgwait_((wg), (dd), MILL_HERE_)
+#define condinit mill_condinit_
+#define condwait(c, m, dd) mill_condwait_((c), (m), (dd), MILL_HERE_)
+#define condsignal(c) mill_condsignal_((c), MILL_HERE_)
+#define condbroadcast(c) mill_condbroadcast_((c), MILL_HERE_)
 #endif
 
 /******************************************************************************/
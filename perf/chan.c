@@ -39,24 +39,32 @@ static coroutine void worker(chan in, chan out) {
 }
 
 int main(int argc, char *argv[]) {
-    if(argc != 2) {
-        printf("usage: chan <millions-of-roundtrips>\n");
+    if(argc != 2 && argc != 3) {
+        printf("usage: chan <millions-of-roundtrips> [buffer-size]\n");
         return 1;
     }
     long count = atol(argv[1]) * 1000000;
+    size_t bufsz = argc == 3 ? (size_t)atol(argv[2]) : 0;
 
-    chan out = chmake(int, 0);
-    chan in = chmake(int, 0);
+    chan out = chmake(int, bufsz);
+    chan in = chmake(int, bufsz);
 
     int64_t start = now();
     go(worker(out, in));
 
+    /* With buffered channels, keep the buffers full so that messages are
+       passed in batches rather than one context switch per message. */
     int val = 0;
     long i;
-    for(i = 0; i != count; ++i) {
+    size_t j;
+    for(j = 0; j != bufsz && j != count; ++j)
+        chs(out, int, val);
+    for(i = 0; i != count - (long)j; ++i) {
         chs(out, int, val);
         val = chr(in, int);
     }
+    for(; j != 0; --j)
+        val = chr(in, int);
 
     int64_t stop = now();
     long duration = (long)(stop - start);
@@ -0,0 +1,51 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../libmill.h"
+
+int main(int argc, char *argv[]) {
+    if(argc != 2) {
+        printf("usage: now <millions-of-calls>\n");
+        return 1;
+    }
+    long count = atol(argv[1]) * 1000000;
+
+    int64_t start = nowns();
+    int64_t sum = 0;
+    long i;
+    for(i = 0; i != count; ++i)
+        sum += now();
+    int64_t stop = nowns();
+
+    printf("performed %ldM calls to now() in %f seconds\n",
+        (long)(count / 1000000), ((float)(stop - start)) / 1000000000);
+    printf("duration of one call: %f ns\n",
+        ((float)(stop - start)) / count);
+    /* Make sure the calls are not optimised out. */
+    return sum == 42 ? 1 : 0;
+}
@@ -22,6 +22,7 @@
 
 */
 
+#include <errno.h>
 #include <stdint.h>
 #include <sys/param.h>
 
@@ -38,6 +39,7 @@ static void mill_poller_add(int fd, int events);
 static void mill_poller_rm(struct mill_cr *cr);
 static void mill_poller_clean(int fd);
 static int mill_poller_wait(int timeout);
+static int mill_poller_setprecise(int enable);
 
 /* If 1, mill_poller_init was already called. */
 static int mill_poller_initialised = 0;
@@ -47,15 +49,17 @@ do {\
     if(mill_slow(!mill_poller_initialised)) {\
         mill_poller_init();\
         mill_assert(errno == 0);\
-        mill_main.fd = -1;\
-        mill_main.timer.expiry = -1;\
         mill_poller_initialised = 1;\
     }\
 } while(0)
 
 /* Pause current coroutine for a specified time interval. */
 void mill_msleep_(int64_t deadline, const char *current) {
-    mill_fdwait_(-1, 0, deadline, current);
+    mill_fdwaitns_(-1, 0, mill_ms2ns(deadline), current);
+}
+
+void mill_msleepns_(int64_t deadline, const char *current) {
+    mill_fdwaitns_(-1, 0, deadline, current);
 }
 
 static void mill_poller_callback(struct mill_timer *timer) {
@@ -65,8 +69,24 @@ static void mill_poller_callback(struct mill_timer *timer) {
         mill_poller_rm(cr);
 }
 
+void mill_poller_cancel(struct mill_cr *cr) {
+    if(mill_timer_enabled(&cr->timer))
+        mill_timer_rm(&cr->timer);
+    if(cr->fd != -1)
+        mill_poller_rm(cr);
+}
+
 int mill_fdwait_(int fd, int events, int64_t deadline, const char *current) {
+    return mill_fdwaitns_(fd, events, mill_ms2ns(deadline), current);
+}
+
+int mill_fdwaitns_(int fd, int events, int64_t deadline,
+      const char *current) {
     check_poller_initialised();
+    if(mill_slow(mill_running->cancelled)) {
+        errno = ECANCELED;
+        return -1;
+    }
     /* If required, start waiting for the timeout. */
     if(deadline >= 0)
         mill_timer_add(&mill_running->timer, deadline, mill_poller_callback);
@@ -79,6 +99,12 @@ int mill_fdwait_(int fd, int events, int64_t deadline, const char *current) {
     mill_running->events = events;
     mill_set_current(&mill_running->debug, current);
     int rc = mill_suspend();
+    /* Handle cancellation. */
+    if(mill_slow(rc == MILL_CANCELLED)) {
+        mill_assert(mill_running->fd == -1);
+        errno = ECANCELED;
+        return -1;
+    }
     /* Handle file descriptor events. */
     if(rc >= 0) {
         mill_assert(!mill_timer_enabled(&mill_running->timer));
@@ -94,8 +120,32 @@ void mill_fdclean_(int fd) {
     mill_poller_clean(fd);
 }
 
+int mill_setprecisetimers_(int enable) {
+    check_poller_initialised();
+    return mill_poller_setprecise(enable);
+}
+
+int mill_busypoll = 0;
+
+void mill_setbusypoll_(int budget) {
+    mill_busypoll = budget > 0 ? budget : 0;
+}
+
 void mill_wait(int block) {
     check_poller_initialised();
+    /* In busy-polling mode spin for a while before blocking to avoid
+       the latency of being woken up by the kernel. */
+    if(block && mill_busypoll) {
+        int64_t deadline = mill_os_time_ns() + (int64_t)mill_busypoll * 1000;
+        do {
+            int fd_fired = mill_poller_wait(0);
+            int timer_fired = mill_timer_fire();
+            if(fd_fired || timer_fired) {
+                ++mill_stats.busy;
+                return;
+            }
+        } while(mill_os_time_ns() < deadline);
+    }
     while(1) {
         /* Compute timeout for the subsequent poll. */
         int timeout = block ? mill_timer_next() : 0;
@@ -35,6 +35,16 @@ void mill_poller_init(void);
    it will block until there's at least one event to process. */
 void mill_wait(int block);
 
+/* Number of microseconds mill_wait() spins polling for events before
+   blocking. 0 means busy polling is switched off. Sockets created while
+   busy polling is on get SO_BUSY_POLL set to the same value. */
+extern int mill_busypoll;
+
+struct mill_cr;
+
+/* Undoes the fdwait() or msleep() the coroutine is blocked in. */
+void mill_poller_cancel(struct mill_cr *cr);
+
 /* Called in the child process after fork to create a fresh new pollset
    independent from the parent's pollset. */
 void mill_poller_postfork(void);
@@ -0,0 +1,286 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+
+#include "cr.h"
+#include "libmill.h"
+#include "list.h"
+#include "utils.h"
+
+/* All the primitives below keep the blocked coroutines in intrusive lists
+   of waiters, so they never allocate. Whenever possible the resource is
+   handed over directly to the coroutine being woken up. That way only
+   the coroutines that can actually proceed are resumed and a coroutine
+   that comes later can't steal the resource from the one being woken up. */
+
+struct mill_mutex {
+    /* Coroutines waiting for the mutex. */
+    struct mill_list waiters;
+    /* Coroutine holding the mutex. NULL if the mutex is unlocked. */
+    struct mill_cr *owner;
+};
+
+struct mill_sem {
+    /* Coroutines waiting for the semaphore. */
+    struct mill_list waiters;
+    /* Value of the semaphore. Non-zero only if there are no waiters. */
+    int count;
+};
+
+struct mill_wg {
+    /* Coroutines waiting for the counter to drop to zero. */
+    struct mill_list waiters;
+    int counter;
+};
+
+struct mill_cond {
+    /* Coroutines waiting for the condition. */
+    struct mill_list waiters;
+    /* The mutex used by the waiters. NULL if there are no waiters. */
+    struct mill_mutex *mutex;
+};
+
+MILL_CT_ASSERT(sizeof(struct mill_mutex) <= sizeof(mill_mutex_));
+MILL_CT_ASSERT(sizeof(struct mill_sem) <= sizeof(mill_sem_));
+MILL_CT_ASSERT(sizeof(struct mill_wg) <= sizeof(mill_wg_));
+MILL_CT_ASSERT(sizeof(struct mill_cond) <= sizeof(mill_cond_));
+
+/* Translates the result of mill_waitfor() into the return value and errno. */
+static int mill_sync_result(int rc) {
+    if(rc == -1) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    if(rc == MILL_CANCELLED) {
+        errno = ECANCELED;
+        return -1;
+    }
+    errno = 0;
+    return 0;
+}
+
+/******************************************************************************/
+/*  Mutex                                                                     */
+/******************************************************************************/
+
+void mill_mutexinit_(mill_mutex_ *m) {
+    struct mill_mutex *mx = (struct mill_mutex*)m;
+    mill_list_init(&mx->waiters);
+    mx->owner = NULL;
+}
+
+int mill_mutexlock_(mill_mutex_ *m, int64_t deadline, const char *current) {
+    struct mill_mutex *mx = (struct mill_mutex*)m;
+    mill_trace(current, "mutexlock()");
+    if(mill_fast(!mx->owner)) {
+        mx->owner = mill_running;
+        errno = 0;
+        return 0;
+    }
+    if(mill_slow(mx->owner == mill_running))
+        mill_panic("mutex is already locked by this coroutine");
+    /* Mutex is passed to us by mill_mutexunlock_(). */
+    int rc = mill_waitfor(&mx->waiters, MILL_MUTEXLOCK, deadline, current);
+    mill_assert(rc != 0 || mx->owner == mill_running);
+    return mill_sync_result(rc);
+}
+
+/* Hands the mutex over to the first waiter, if any. */
+static void mill_mutex_release(struct mill_mutex *mx) {
+    if(mill_list_empty(&mx->waiters)) {
+        mx->owner = NULL;
+        return;
+    }
+    mx->owner = mill_cont(mill_list_begin(&mx->waiters), struct mill_cr,
+        waiter);
+    mill_wakeup(mx->owner, 0);
+}
+
+void mill_mutexunlock_(mill_mutex_ *m, const char *current) {
+    struct mill_mutex *mx = (struct mill_mutex*)m;
+    mill_trace(current, "mutexunlock()");
+    if(mill_slow(mx->owner != mill_running))
+        mill_panic("mutex is not locked by this coroutine");
+    mill_mutex_release(mx);
+}
+
+/* Locks the mutex even if the coroutine was cancelled. Used to re-acquire
+   the mutex when condwait() fails. */
+static void mill_mutex_relock(struct mill_mutex *mx, const char *current) {
+    int cancelled = mill_running->cancelled;
+    mill_running->cancelled = 0;
+    while(mx->owner != mill_running) {
+        if(!mx->owner) {
+            mx->owner = mill_running;
+            break;
+        }
+        int rc = mill_waitfor(&mx->waiters, MILL_MUTEXLOCK, -1, current);
+        if(rc == MILL_CANCELLED) {
+            cancelled = 1;
+            mill_running->cancelled = 0;
+        }
+    }
+    mill_running->cancelled = cancelled;
+}
+
+/******************************************************************************/
+/*  Semaphore                                                                 */
+/******************************************************************************/
+
+void mill_seminit_(mill_sem_ *s, int count) {
+    struct mill_sem *sm = (struct mill_sem*)s;
+    if(mill_slow(count < 0))
+        mill_panic("semaphore initialised to a negative value");
+    mill_list_init(&sm->waiters);
+    sm->count = count;
+}
+
+int mill_semwait_(mill_sem_ *s, int64_t deadline, const char *current) {
+    struct mill_sem *sm = (struct mill_sem*)s;
+    mill_trace(current, "semwait()");
+    if(mill_fast(sm->count > 0)) {
+        --sm->count;
+        errno = 0;
+        return 0;
+    }
+    /* The unit is passed to us by mill_sempost_() without ever being added
+       to the count. */
+    int rc = mill_waitfor(&sm->waiters, MILL_SEMWAIT, deadline, current);
+    return mill_sync_result(rc);
+}
+
+void mill_sempost_(mill_sem_ *s, const char *current) {
+    struct mill_sem *sm = (struct mill_sem*)s;
+    mill_trace(current, "sempost()");
+    if(!mill_list_empty(&sm->waiters)) {
+        mill_wakeup(mill_cont(mill_list_begin(&sm->waiters), struct mill_cr,
+            waiter), 0);
+        return;
+    }
+    ++sm->count;
+}
+
+/******************************************************************************/
+/*  Wait group                                                                */
+/******************************************************************************/
+
+void mill_wginit_(mill_wg_ *wg) {
+    struct mill_wg *w = (struct mill_wg*)wg;
+    mill_list_init(&w->waiters);
+    w->counter = 0;
+}
+
+void mill_wgadd_(mill_wg_ *wg, int n, const char *current) {
+    struct mill_wg *w = (struct mill_wg*)wg;
+    mill_trace(current, "wgadd(%d)", n);
+    w->counter += n;
+    if(mill_slow(w->counter < 0))
+        mill_panic("negative wait group counter");
+    if(w->counter)
+        return;
+    while(!mill_list_empty(&w->waiters))
+        mill_wakeup(mill_cont(mill_list_begin(&w->waiters), struct mill_cr,
+            waiter), 0);
+}
+
+int mill_wgwait_(mill_wg_ *wg, int64_t deadline, const char *current) {
+    struct mill_wg *w = (struct mill_wg*)wg;
+    mill_trace(current, "wgwait()");
+    if(!w->counter) {
+        errno = 0;
+        return 0;
+    }
+    int rc = mill_waitfor(&w->waiters, MILL_WGWAIT, deadline, current);
+    return mill_sync_result(rc);
+}
+
+/******************************************************************************/
+/*  Condition variable                                                        */
+/******************************************************************************/
+
+void mill_condinit_(mill_cond_ *c) {
+    struct mill_cond *cv = (struct mill_cond*)c;
+    mill_list_init(&cv->waiters);
+    cv->mutex = NULL;
+}
+
+int mill_condwait_(mill_cond_ *c, mill_mutex_ *m, int64_t deadline,
+      const char *current) {
+    struct mill_cond *cv = (struct mill_cond*)c;
+    struct mill_mutex *mx = (struct mill_mutex*)m;
+    mill_trace(current, "condwait()");
+    if(mill_slow(mx->owner != mill_running))
+        mill_panic("condwait without holding the mutex");
+    if(mill_slow(cv->mutex && cv->mutex != mx))
+        mill_panic("condwait with different mutexes");
+    if(mill_slow(mill_running->cancelled)) {
+        errno = ECANCELED;
+        return -1;
+    }
+    cv->mutex = mx;
+    mill_mutex_release(mx);
+    /* When signalled, we are moved to the mutex's list of waiters and
+       resumed only once the mutex is handed over to us. */
+    int rc = mill_waitfor(&cv->waiters, MILL_CONDWAIT, deadline, current);
+    if(mill_list_empty(&cv->waiters))
+        cv->mutex = NULL;
+    if(rc == 0) {
+        mill_assert(mx->owner == mill_running);
+        errno = 0;
+        return 0;
+    }
+    mill_mutex_relock(mx, current);
+    return mill_sync_result(rc);
+}
+
+/* Moves the first waiter over to the mutex. */
+static void mill_cond_wake(struct mill_cond *cv) {
+    struct mill_cr *cr = mill_cont(mill_list_begin(&cv->waiters),
+        struct mill_cr, waiter);
+    struct mill_mutex *mx = cv->mutex;
+    if(!mx->owner) {
+        mx->owner = cr;
+        mill_wakeup(cr, 0);
+    }
+    else {
+        mill_requeue(cr, &mx->waiters, MILL_MUTEXLOCK);
+    }
+    if(mill_list_empty(&cv->waiters))
+        cv->mutex = NULL;
+}
+
+void mill_condsignal_(mill_cond_ *c, const char *current) {
+    struct mill_cond *cv = (struct mill_cond*)c;
+    mill_trace(current, "condsignal()");
+    if(!mill_list_empty(&cv->waiters))
+        mill_cond_wake(cv);
+}
+
+void mill_condbroadcast_(mill_cond_ *c, const char *current) {
+    struct mill_cond *cv = (struct mill_cond*)c;
+    mill_trace(current, "condbroadcast()");
+    while(!mill_list_empty(&cv->waiters))
+        mill_cond_wake(cv);
+}
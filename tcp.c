@@ -36,6 +36,7 @@
 #include "debug.h"
 #include "ip.h"
 #include "libmill.h"
+#include "poller.h"
 #include "utils.h"
 
 /* The buffer size is based on typical Ethernet MTU (1500 bytes). Making it
@@ -91,6 +92,15 @@ static void mill_tcptune(int s) {
     rc = setsockopt (s, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof (opt));
     mill_assert (rc == 0 || errno == EINVAL);
 #endif
+#ifdef SO_BUSY_POLL
+    /* In busy-polling mode ask the kernel to busy poll the device queue
+       as well. Raising the value above the system default requires
+       CAP_NET_ADMIN so the failure is ignored. */
+    if(mill_busypoll) {
+        opt = mill_busypoll;
+        setsockopt(s, SOL_SOCKET, SO_BUSY_POLL, &opt, sizeof (opt));
+    }
+#endif
 }
 
 static void tcpconn_init(struct mill_tcpconn *conn, int fd) {
@@ -189,6 +199,8 @@ struct mill_tcpsock_ *mill_tcpaccept_(struct mill_tcpsock_ *s, int64_t deadline)
             return NULL;
         /* Wait till new connection is available. */
         int rc = fdwait(l->fd, FDW_IN, deadline);
+        if(rc < 0)
+            return NULL;
         if(rc == 0) {
             errno = ETIMEDOUT;
             return NULL;
@@ -213,6 +225,8 @@ struct mill_tcpsock_ *mill_tcpconnect_(ipaddr addr, int64_t deadline) {
         if(errno != EINPROGRESS)
             return NULL;
         rc = fdwait(s, FDW_OUT, deadline);
+        if(rc < 0)
+            return NULL;
         if(rc == 0) {
             errno = ETIMEDOUT;
             return NULL;
@@ -291,6 +305,8 @@ size_t mill_tcpsend_(struct mill_tcpsock_ *s, const void *buf, size_t len,
             if(errno != EAGAIN && errno != EWOULDBLOCK)
                 return 0;
             int rc = fdwait(conn->fd, FDW_OUT, deadline);
+            if(rc < 0)
+                return len - remaining;
             if(rc == 0) {
                 errno = ETIMEDOUT;
                 return len - remaining;
@@ -326,6 +342,8 @@ void mill_tcpflush_(struct mill_tcpsock_ *s, int64_t deadline) {
             if(errno != EAGAIN && errno != EWOULDBLOCK)
                 return;
             int rc = fdwait(conn->fd, FDW_OUT, deadline);
+            if(rc < 0)
+                return;
             if(rc == 0) {
                 errno = ETIMEDOUT;
                 return;
@@ -415,6 +433,8 @@ size_t mill_tcprecv_(struct mill_tcpsock_ *s, void *buf, size_t len,
 
         /* Wait till there's more data to read. */
         int res = fdwait(conn->fd, FDW_IN, deadline);
+        if(res < 0)
+            return len - remaining;
         if(!res) {
             errno = ETIMEDOUT;
             return len - remaining;
@@ -0,0 +1,108 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <errno.h>
+
+#include "../libmill.h"
+
+static int sum = 0;
+
+coroutine void subscriber(bchan b, int count, chan ready) {
+    bchsub s = bchsubscribe(b);
+    assert(s);
+    chs(ready, int, 0);
+    int i;
+    for(i = 0; i != count; ++i) {
+        int val = bchr(s, int);
+        assert(errno == 0);
+        assert(val == i);
+        sum += val;
+    }
+    bchunsubscribe(s);
+    chs(ready, int, 0);
+}
+
+coroutine void slow(bchan b, int count, chan ready) {
+    bchsub s = bchsubscribe(b);
+    chs(ready, int, 0);
+    int i;
+    for(i = 0; i != count; ++i) {
+        msleep(now() + 1);
+        assert(bchr(s, int) == i);
+    }
+    bchunsubscribe(s);
+    chs(ready, int, 0);
+}
+
+int main() {
+    /* Every subscriber gets every message. */
+    bchan b = bchmake(int, 4, BCH_BLOCK);
+    assert(b);
+    chan ready = chmake(int, 0);
+    int i;
+    for(i = 0; i != 100; ++i) {
+        go(subscriber(b, 10, ready));
+        chr(ready, int);
+    }
+    for(i = 0; i != 10; ++i)
+        bchpub(b, int, i);
+    for(i = 0; i != 100; ++i)
+        chr(ready, int);
+    assert(sum == 100 * 45);
+
+    /* Publisher is blocked by a slow subscriber. */
+    go(slow(b, 20, ready));
+    chr(ready, int);
+    int64_t start = now();
+    for(i = 0; i != 20; ++i)
+        bchpub(b, int, i);
+    assert(now() - start >= 15);
+    chr(ready, int);
+    bchclose(b);
+
+    /* Slow subscriber loses the oldest messages. */
+    b = bchmake(int, 4, BCH_DROP);
+    bchsub s = bchsubscribe(b);
+    for(i = 0; i != 10; ++i)
+        bchpub(b, int, i);
+    for(i = 6; i != 10; ++i)
+        assert(bchr(s, int) == i);
+    assert(bchmissed(s) == 6);
+    /* Subscriber joining late gets only the new messages. */
+    bchsub s2 = bchsubscribe(b);
+    bchpub(b, int, 10);
+    assert(bchr(s2, int) == 10);
+    assert(bchr(s, int) == 10);
+    assert(bchmissed(s2) == 0);
+    bchunsubscribe(s2);
+    bchunsubscribe(s);
+    bchclose(b);
+
+    b = bchmake(int, 0, BCH_DROP);
+    assert(!b && errno == EINVAL);
+    chclose(ready);
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <string.h>
+
+#include "../libmill.h"
+
+coroutine void sender(udpsock s, ipaddr addr) {
+    msleep(now() + 10);
+    udpsend(s, addr, "ABC", 3);
+    assert(errno == 0);
+}
+
+int main() {
+    setbusypoll(200000);
+
+    /* Timer expiry is detected while spinning. */
+    struct mill_pollstats stats;
+    pollstats(&stats);
+    int64_t deadline = now() + 10;
+    msleep(deadline);
+    assert(now() >= deadline);
+    struct mill_pollstats stats2;
+    pollstats(&stats2);
+    assert(stats2.busy > stats.busy);
+
+    /* Incoming packet is detected while spinning. */
+    ipaddr addr = iplocal(NULL, 5575, 0);
+    udpsock s1 = udplisten(addr);
+    assert(s1);
+    udpsock s2 = udplisten(iplocal(NULL, 5576, 0));
+    assert(s2);
+    go(sender(s2, addr));
+    char buf[3];
+    size_t sz = udprecv(s1, NULL, buf, sizeof(buf), now() + 1000);
+    assert(errno == 0);
+    assert(sz == 3 && memcmp(buf, "ABC", 3) == 0);
+    udpclose(s2);
+    udpclose(s1);
+
+    /* Busy polling can be switched off again. */
+    setbusypoll(0);
+    pollstats(&stats);
+    msleep(now() + 10);
+    pollstats(&stats2);
+    assert(stats2.busy == stats.busy);
+    assert(stats2.idle > stats.idle);
+
+    return 0;
+}
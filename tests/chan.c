@@ -26,6 +26,8 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "../libmill.h"
@@ -35,6 +37,27 @@ struct foo {
     int second;
 };
 
+struct pair {
+    int64_t a;
+    int64_t b;
+};
+
+struct big {
+    int seq;
+    char data[4096];
+};
+
+coroutine void bigsender(chan ch, int seq) {
+    yield();
+    struct big *b = malloc(sizeof(struct big));
+    assert(b);
+    b->seq = seq;
+    memset(b->data, 'a' + seq, sizeof(b->data));
+    chs(ch, struct big, *b);
+    free(b);
+    chclose(ch);
+}
+
 coroutine void sender(chan ch, int doyield, int val) {
     if(doyield)
         yield();
@@ -193,6 +216,84 @@ int main() {
     assert(val == 2);
     chclose(ch14);
 
+    /* Capacity of the channel is not rounded up to the power of two. */
+    chan ch15 = chmake(int, 3);
+    int i;
+    for(i = 0; i != 10; ++i) {
+        chs(ch15, int, i);
+        chs(ch15, int, i + 100);
+        chs(ch15, int, i + 200);
+        int full = 0;
+        choose {
+        out(ch15, int, 0):
+        otherwise:
+            full = 1;
+        end
+        }
+        assert(full);
+        val = chr(ch15, int);
+        assert(val == i);
+        val = chr(ch15, int);
+        assert(val == i + 100);
+        chs(ch15, int, i + 300);
+        val = chr(ch15, int);
+        assert(val == i + 200);
+        val = chr(ch15, int);
+        assert(val == i + 300);
+    }
+    chs(ch15, int, 1);
+    chs(ch15, int, 2);
+    chs(ch15, int, 3);
+    chdone(ch15, int, 4);
+    for(i = 1; i != 6; ++i) {
+        val = chr(ch15, int);
+        assert(val == (i < 4 ? i : 4));
+    }
+    chclose(ch15);
+
+    /* 16-byte elements. */
+    struct pair pair = {1, 2};
+    chan ch16 = chmake(struct pair, 5);
+    chs(ch16, struct pair, pair);
+    pair.a = 3;
+    chs(ch16, struct pair, pair);
+    pair = chr(ch16, struct pair);
+    assert(pair.a == 1 && pair.b == 2);
+    pair = chr(ch16, struct pair);
+    assert(pair.a == 3 && pair.b == 2);
+    chclose(ch16);
+
+    /* Closed channels are reused and come back in a clean state. */
+    chan ch17 = chmake(int, 1);
+    chs(ch17, int, 1);
+    chdone(ch17, int, 2);
+    chclose(ch17);
+    chan ch18 = chmake(int, 1);
+    assert(ch18 == ch17);
+    chs(ch18, int, 3);
+    val = chr(ch18, int);
+    assert(val == 3);
+    chclose(ch18);
+
+    /* Receive large values directly into the caller's storage. */
+    chan ch19 = chmake(struct big, 1);
+    static struct big big;
+    go(bigsender(chdup(ch19), 1));
+    int rc = chrto(ch19, struct big, &big);
+    assert(rc == 0);
+    assert(big.seq == 1 && big.data[0] == 'b' && big.data[4095] == 'b');
+    go(bigsender(chdup(ch19), 2));
+    yield();
+    rc = chrto(ch19, struct big, &big);
+    assert(rc == 0);
+    assert(big.seq == 2 && big.data[0] == 'c' && big.data[4095] == 'c');
+    big.seq = 3;
+    chdone(ch19, struct big, big);
+    big.seq = 0;
+    rc = chrto(ch19, struct big, &big);
+    assert(rc == 0 && big.seq == 3);
+    chclose(ch19);
+
     return 0;
 }
 
@@ -23,6 +23,7 @@
 */
 
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 
 #include "../libmill.h"
@@ -412,6 +413,63 @@ int main() {
     assert(diff > 30 && diff < 70);
     chclose(ch22);
 
+    /* Seeded random choice is reproducible. */
+    chan chans[3];
+    for(i = 0; i != 3; ++i) {
+        chans[i] = chmake(int, 1);
+        chs(chans[i], int, i);
+    }
+    int seq[2][64];
+    int run;
+    int rc;
+    for(run = 0; run != 2; ++run) {
+        rc = choosemode(CHOOSE_RANDOM, 1234);
+        assert(rc == 0);
+        for(i = 0; i != 64; ++i) {
+            choose {
+            in(chans[0], int, val):
+                seq[run][i] = val;
+            in(chans[1], int, val):
+                seq[run][i] = val;
+            in(chans[2], int, val):
+                seq[run][i] = val;
+            end
+            }
+            chs(chans[seq[run][i]], int, seq[run][i]);
+        }
+    }
+    int counts[3] = {0, 0, 0};
+    for(i = 0; i != 64; ++i) {
+        assert(seq[0][i] == seq[1][i]);
+        ++counts[seq[0][i]];
+    }
+    assert(counts[0] && counts[1] && counts[2]);
+
+    /* Round-robin choice is perfectly fair. */
+    rc = choosemode(CHOOSE_ROUNDROBIN, 0);
+    assert(rc == 0);
+    counts[0] = counts[1] = counts[2] = 0;
+    for(i = 0; i != 30; ++i) {
+        int v;
+        choose {
+        in(chans[0], int, val):
+            v = val;
+        in(chans[1], int, val):
+            v = val;
+        in(chans[2], int, val):
+            v = val;
+        end
+        }
+        ++counts[v];
+        chs(chans[v], int, v);
+    }
+    assert(counts[0] == 10 && counts[1] == 10 && counts[2] == 10);
+    rc = choosemode(42, 0);
+    assert(rc == -1 && errno == EINVAL);
+    choosemode(CHOOSE_RANDOM, 0);
+    for(i = 0; i != 3; ++i)
+        chclose(chans[i]);
+
     return 0;
 }
 
@@ -0,0 +1,88 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <string.h>
+
+#include "../libmill.h"
+
+struct msg {
+    int seq;
+    char payload[1000];
+};
+
+coroutine void producer(chan ch, int count) {
+    int i;
+    for(i = 0; i != count; ++i) {
+        struct msg *m = challoc(ch);
+        assert(m);
+        m->seq = i;
+        memset(m->payload, 'a' + i % 26, sizeof(m->payload));
+        chs(ch, struct msg*, m);
+    }
+    chs(ch, struct msg*, NULL);
+}
+
+int main() {
+    /* Ownership of the message passes to the receiver. */
+    chan ch = chmakep(struct msg, 4);
+    assert(ch);
+    go(producer(chdup(ch), 100));
+    int i = 0;
+    while(1) {
+        struct msg *m = chr(ch, struct msg*);
+        if(!m)
+            break;
+        assert(m->seq == i);
+        assert(m->payload[0] == 'a' + i % 26);
+        assert(m->payload[sizeof(m->payload) - 1] == 'a' + i % 26);
+        chfree(m);
+        ++i;
+    }
+    assert(i == 100);
+    chclose(ch);
+
+    /* Returned messages are reused. */
+    ch = chmakep(struct msg, 0);
+    struct msg *m1 = challoc(ch);
+    chfree(m1);
+    struct msg *m2 = challoc(ch);
+    assert(m1 == m2);
+    chfree(m2);
+    chfree(NULL);
+
+    /* Messages may outlive the channel. */
+    m1 = challoc(ch);
+    chclose(ch);
+    m1->seq = 1;
+    chfree(m1);
+
+    /* Messages left in the channel are released when it is closed. */
+    ch = chmakep(struct msg, 2);
+    chs(ch, struct msg*, challoc(ch));
+    chs(ch, struct msg*, challoc(ch));
+    chclose(ch);
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <errno.h>
+
+#include "../libmill.h"
+
+#define NCHANS 1000
+
+coroutine void sender(chan ch, int val) {
+    chs(ch, int, val);
+}
+
+coroutine void delayed(chan ch, int val) {
+    msleep(now() + 10);
+    chs(ch, int, val);
+}
+
+int main() {
+    chan chans[NCHANS];
+    chset s = chsetmake();
+    assert(s);
+    int i;
+    for(i = 0; i != NCHANS; ++i) {
+        chans[i] = chmake(int, 1);
+        assert(chsetadd(s, chans[i]) == 0);
+    }
+    assert(chsetadd(s, chans[0]) == -1 && errno == EEXIST);
+
+    /* Nothing is ready. */
+    chan ready[16];
+    int rc = chsetwait(s, ready, 16, 0);
+    assert(rc == -1 && errno == ETIMEDOUT);
+    rc = chsetwait(s, ready, 16, now() + 10);
+    assert(rc == -1 && errno == ETIMEDOUT);
+
+    /* Buffered messages. */
+    chs(chans[10], int, 10);
+    chs(chans[500], int, 500);
+    rc = chsetwait(s, ready, 16, -1);
+    assert(rc == 2);
+    assert(ready[0] == chans[10] && ready[1] == chans[500]);
+    assert(chr(ready[0], int) == 10);
+    assert(chr(ready[1], int) == 500);
+    rc = chsetwait(s, ready, 16, 0);
+    assert(rc == -1 && errno == ETIMEDOUT);
+
+    /* Blocked senders, reported a few at a time. */
+    chan unbuf[3];
+    for(i = 0; i != 3; ++i) {
+        unbuf[i] = chmake(int, 0);
+        assert(chsetadd(s, unbuf[i]) == 0);
+        go(sender(unbuf[i], i));
+    }
+    int sum = 0;
+    for(i = 0; i != 3; ++i) {
+        rc = chsetwait(s, ready, 1, -1);
+        assert(rc == 1);
+        sum += chr(ready[0], int);
+    }
+    assert(sum == 3);
+
+    /* Waiting for a message that arrives later. */
+    go(delayed(chans[999], 999));
+    rc = chsetwait(s, ready, 16, now() + 1000);
+    assert(rc == 1 && ready[0] == chans[999]);
+    assert(chr(ready[0], int) == 999);
+
+    /* Done-with channel stays readable. */
+    chdone(chans[7], int, -1);
+    for(i = 0; i != 2; ++i) {
+        rc = chsetwait(s, ready, 16, 0);
+        assert(rc == 1 && ready[0] == chans[7]);
+        assert(chr(ready[0], int) == -1);
+    }
+    assert(chsetrm(s, chans[7]) == 0);
+    assert(chsetrm(s, chans[7]) == -1 && errno == ENOENT);
+    rc = chsetwait(s, ready, 16, 0);
+    assert(rc == -1 && errno == ETIMEDOUT);
+
+    /* Closed channel is removed from the set. */
+    chs(chans[3], int, 3);
+    chclose(chans[3]);
+    rc = chsetwait(s, ready, 16, 0);
+    assert(rc == -1 && errno == ETIMEDOUT);
+
+    for(i = 0; i != 3; ++i)
+        chclose(unbuf[i]);
+    chsetclose(s);
+    for(i = 0; i != NCHANS; ++i)
+        if(i != 3)
+            chclose(chans[i]);
+
+    return 0;
+}
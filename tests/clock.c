@@ -0,0 +1,68 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../libmill.h"
+
+static int64_t os_ns(void) {
+    struct timespec ts;
+    int rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(rc == 0);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main() {
+    /* The clock never goes backwards, neither while it's being calibrated
+       nor afterwards. */
+    int64_t start = os_ns();
+    int64_t last = nowns();
+    while(os_ns() - start < 1500000000) {
+        int i;
+        for(i = 0; i != 1000; ++i) {
+            int64_t nw = nowns();
+            assert(nw >= last);
+            last = nw;
+        }
+    }
+
+    /* The clock agrees with the OS clock. */
+    int j;
+    for(j = 0; j != 10; ++j) {
+        int64_t before = os_ns();
+        int64_t nw = nowns();
+        int64_t after = os_ns();
+        assert(nw > before - 1000000 && nw < after + 1000000);
+        msleep(now() + 10);
+    }
+
+    /* Coarser clocks are derived from the same source. */
+    int64_t ns = nowns();
+    int64_t ms = now();
+    assert(ms - ns / 1000000 >= 0 && ms - ns / 1000000 <= 1);
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <errno.h>
+
+#include "../libmill.h"
+
+struct request {
+    int arg;
+    future *reply;
+};
+
+struct pair {
+    int first;
+    int second;
+};
+
+coroutine void server(chan requests) {
+    while(1) {
+        struct request req = chr(requests, struct request);
+        if(!req.reply)
+            break;
+        futset(req.reply, int, req.arg * 2);
+    }
+    chclose(requests);
+}
+
+coroutine void delayed(future *f, int64_t deadline, struct pair val) {
+    msleep(deadline);
+    futset(f, struct pair, val);
+}
+
+coroutine void waiter(future *f) {
+    int rc = futwait(f, -1);
+    assert(rc == -1 && errno == ECANCELED);
+}
+
+int main() {
+    /* Request-reply. */
+    chan requests = chmake(struct request, 0);
+    go(server(chdup(requests)));
+    int i;
+    for(i = 0; i != 100; ++i) {
+        int reply = 0;
+        future f;
+        futinit(&f, &reply);
+        struct request req = {i, &f};
+        chs(requests, struct request, req);
+        int rc = futwait(&f, -1);
+        assert(rc == 0);
+        assert(reply == i * 2);
+    }
+    struct request done = {0, NULL};
+    chs(requests, struct request, done);
+    chclose(requests);
+
+    /* Future set before anyone waits for it. */
+    int val = 0;
+    future f;
+    futinit(&f, &val);
+    futset(&f, int, 42);
+    assert(val == 42);
+    int rc = futwait(&f, -1);
+    assert(rc == 0);
+    rc = futwait(&f, now() + 10);
+    assert(rc == 0);
+
+    /* Wait with a deadline. */
+    struct pair pair = {0, 0};
+    futinit(&f, &pair);
+    struct pair expected = {1, 2};
+    go(delayed(&f, now() + 50, expected));
+    rc = futwait(&f, now() + 10);
+    assert(rc == -1 && errno == ETIMEDOUT);
+    rc = futwait(&f, -1);
+    assert(rc == 0);
+    assert(pair.first == 1 && pair.second == 2);
+
+    /* Cancel a waiting coroutine. */
+    futinit(&f, &val);
+    gohandle h = goh(waiter(&f));
+    gocancel(h);
+    rc = gojoin(h, -1);
+    assert(rc == 0);
+
+    return 0;
+}
@@ -43,6 +43,58 @@ coroutine void dummy(void) {
     msleep(now() + 50);
 }
 
+void bulk(void *arg) {
+    ++*(int*)arg;
+}
+
+void bulksender(void *arg) {
+    chs(*(chan*)arg, int, 1);
+}
+
+#if defined __x86_64__ || defined __aarch64__
+#if defined __x86_64__
+/* Rounding control bits of MXCSR. */
+#define ROUNDMASK 0x6000u
+#define ROUNDUP 0x4000u
+
+static unsigned long getfpctl(void) {
+    unsigned int mxcsr;
+    __asm__ volatile("stmxcsr %0" : "=m" (mxcsr));
+    return mxcsr;
+}
+
+static void setfpctl(unsigned long val) {
+    unsigned int mxcsr = (unsigned int)val;
+    __asm__ volatile("ldmxcsr %0" : : "m" (mxcsr));
+}
+#else
+/* Rounding control bits of FPCR. */
+#define ROUNDMASK 0xc00000ul
+#define ROUNDUP 0x400000ul
+
+static unsigned long getfpctl(void) {
+    unsigned long fpcr;
+    __asm__ volatile("mrs %0, fpcr" : "=r" (fpcr));
+    return fpcr;
+}
+
+static void setfpctl(unsigned long fpcr) {
+    __asm__ volatile("msr fpcr, %0" : : "r" (fpcr));
+}
+#endif
+
+coroutine void roundup(chan ch) {
+    /* Switch rounding mode to "round up". */
+    unsigned long fpctl = getfpctl();
+    setfpctl((fpctl & ~ROUNDMASK) | ROUNDUP);
+    chs(ch, int, 1);
+    chr(ch, int);
+    assert((getfpctl() & ROUNDMASK) == ROUNDUP);
+    setfpctl(fpctl);
+    chs(ch, int, 2);
+}
+#endif
+
 int main() {
     goprepare(10, 25000, 300);
 
@@ -60,6 +112,30 @@ int main() {
         go(dummy());
     msleep(now() + 100);
 
+    /* Launch a batch of coroutines in one go. */
+    int bulkcount = 0;
+    gomany(bulk, &bulkcount, 100);
+    yield();
+    assert(bulkcount == 100);
+    chan ch = chmake(int, 0);
+    gomany(bulksender, &ch, 20);
+    for(i = 0; i != 20; ++i)
+        assert(chr(ch, int) == 1);
+    chclose(ch);
+
+#if defined __x86_64__ || defined __aarch64__
+    /* Floating point control settings are part of the coroutine context. */
+    ch = chmake(int, 0);
+    unsigned long fpctl = getfpctl();
+    go(roundup(ch));
+    assert(chr(ch, int) == 1);
+    assert(getfpctl() == fpctl);
+    chs(ch, int, 0);
+    assert(chr(ch, int) == 2);
+    assert(getfpctl() == fpctl);
+    chclose(ch);
+#endif
+
     /* Try to fork the process. */
     pid_t pid = mfork();
     assert(pid != -1);
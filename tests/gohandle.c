@@ -0,0 +1,251 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../libmill.h"
+
+int result = 0;
+
+coroutine void quick(void) {
+    result = 1;
+}
+
+coroutine void sleeper(int64_t deadline) {
+    msleep(deadline);
+    result = errno == ECANCELED ? -1 : 1;
+}
+
+coroutine void blocked(chan ch) {
+    chr(ch, int);
+}
+
+coroutine void nonblocking(chan gate, chan ch) {
+    chr(gate, int);
+    assert(errno == ECANCELED);
+    /* Operations that don't have to block still succeed. */
+    int val = chr(ch, int);
+    assert(errno == 0 && val == 7);
+    chs(ch, int, 8);
+    assert(errno == 0);
+    /* Those that would block fail and return zero. */
+    chs(ch, int, 9);
+    assert(errno == ECANCELED);
+    val = chr(gate, int);
+    assert(errno == ECANCELED && val == 0);
+    result = -1;
+}
+
+coroutine void receiver(chan ch) {
+    chr(ch, int);
+    assert(errno == ECANCELED);
+    /* Once cancelled, all blocking operations fail immediately. */
+    msleep(now() + 1000);
+    assert(errno == ECANCELED);
+    chr(ch, int);
+    assert(errno == ECANCELED);
+    result = -1;
+}
+
+coroutine void chooser(chan ch) {
+    choose {
+    in(ch, int, val):
+        assert(0);
+    end
+    }
+    assert(errno == ECANCELED);
+    choose {
+    in(ch, int, val):
+        assert(0);
+    deadline(now() + 1000):
+        assert(errno == ECANCELED);
+        result = -1;
+    end
+    }
+}
+
+coroutine void waiter(int fd) {
+    int rc = fdwait(fd, FDW_IN, -1);
+    assert(rc == -1 && errno == ECANCELED);
+    result = -1;
+}
+
+coroutine void joiner(gohandle h) {
+    int rc = gojoin(h, -1);
+    assert(rc == -1 && errno == ECANCELED);
+    result = -1;
+}
+
+int joined = 0;
+
+coroutine void twojoiner(gohandle h) {
+    int rc = gojoin(h, -1);
+    assert(rc == 0);
+    ++joined;
+}
+
+coroutine void timedjoiner(gohandle h) {
+    int rc = gojoin(h, now() + 10);
+    assert(rc == -1 && errno == ETIMEDOUT);
+    ++joined;
+}
+
+int main() {
+    /* Join with a deadline a coroutine blocked on a channel. Being the first
+       timer in the process, this checks that the main coroutine's timer
+       is not reset when the poller gets initialised. */
+    chan blk = chmake(int, 0);
+    gohandle h = goh(blocked(blk));
+    int rc = gojoin(h, now() + 10);
+    assert(rc == -1 && errno == ETIMEDOUT);
+    chs(blk, int, 1);
+    rc = gojoin(h, -1);
+    assert(rc == 0);
+    chclose(blk);
+
+    /* Join a coroutine that has already finished. */
+    h = goh(quick());
+    assert(result == 1);
+    rc = gojoin(h, -1);
+    assert(rc == 0);
+
+    /* Join with a deadline. */
+    result = 0;
+    h = goh(sleeper(now() + 50));
+    rc = gojoin(h, now() + 10);
+    assert(rc == -1 && errno == ETIMEDOUT);
+    rc = gojoin(h, -1);
+    assert(rc == 0);
+    assert(result == 1);
+
+    /* Cancel a sleeping coroutine. */
+    result = 0;
+    int64_t start = now();
+    h = goh(sleeper(now() + 1000));
+    gocancel(h);
+    rc = gojoin(h, -1);
+    assert(rc == 0);
+    assert(result == -1);
+    assert(now() - start < 500);
+
+    /* Cancel a coroutine blocked on a channel. */
+    result = 0;
+    chan ch = chmake(int, 0);
+    h = goh(receiver(ch));
+    gocancel(h);
+    rc = gojoin(h, -1);
+    assert(rc == 0);
+    assert(result == -1);
+
+    /* Cancelled coroutine can still do non-blocking channel operations. */
+    result = 0;
+    chan gate = chmake(int, 0);
+    chan buffered = chmake(int, 1);
+    chs(buffered, int, 7);
+    h = goh(nonblocking(gate, buffered));
+    gocancel(h);
+    rc = gojoin(h, -1);
+    assert(rc == 0);
+    assert(result == -1);
+    assert(chr(buffered, int) == 8);
+    chclose(buffered);
+    chclose(gate);
+
+    /* Cancel a coroutine blocked in choose. */
+    result = 0;
+    h = goh(chooser(ch));
+    gocancel(h);
+    rc = gojoin(h, -1);
+    assert(rc == 0);
+    assert(result == -1);
+    chclose(ch);
+
+    /* Cancel a coroutine waiting for a file descriptor. */
+    result = 0;
+    int fds[2];
+    rc = pipe(fds);
+    assert(rc == 0);
+    h = goh(waiter(fds[0]));
+    gocancel(h);
+    rc = gojoin(h, -1);
+    assert(rc == 0);
+    assert(result == -1);
+    fdclean(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+
+    /* Cancel a coroutine blocked in gojoin(). */
+    result = 0;
+    gohandle h2 = goh(sleeper(now() + 50));
+    h = goh(joiner(h2));
+    gocancel(h);
+    rc = gojoin(h, -1);
+    assert(rc == 0);
+    assert(result == -1);
+    rc = gojoin(h2, -1);
+    assert(rc == 0);
+
+    /* Several coroutines joining the same handle. */
+    result = 0;
+    h = goh(sleeper(now() + 50));
+    go(twojoiner(h));
+    go(twojoiner(h));
+    go(timedjoiner(h));
+    rc = gojoin(h, -1);
+    assert(rc == 0);
+    assert(result == 1);
+    yield();
+    assert(joined == 3);
+
+    /* Detach a running coroutine. */
+    result = 0;
+    h = goh(sleeper(now() + 20));
+    godetach(h);
+    msleep(now() + 50);
+    assert(result == 1);
+
+    /* Detach a finished coroutine. */
+    h = goh(quick());
+    godetach(h);
+
+    /* Detach a handle while somebody is joining it. */
+    joined = 0;
+    h = goh(sleeper(now() + 20));
+    go(twojoiner(h));
+    godetach(h);
+    msleep(now() + 50);
+    assert(joined == 1);
+
+    /* Cancelling a finished coroutine is a no-op. */
+    h = goh(quick());
+    gocancel(h);
+    rc = gojoin(h, -1);
+    assert(rc == 0);
+
+    return 0;
+}
+
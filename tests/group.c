@@ -0,0 +1,91 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+
+#include "../libmill.h"
+
+int finished = 0;
+int cancelled = 0;
+
+coroutine void worker(int64_t deadline) {
+    msleep(deadline);
+    if(errno == ECANCELED)
+        ++cancelled;
+    else
+        ++finished;
+}
+
+int main() {
+    /* Waiting for an empty group succeeds immediately. */
+    group g = groupmake();
+    assert(g);
+    int rc = groupwait(g, -1);
+    assert(rc == 0);
+
+    /* Wait till all the coroutines in the group finish. */
+    int i;
+    for(i = 0; i != 10; ++i)
+        groupgo(g, worker(now() + 10 + i));
+    rc = groupwait(g, -1);
+    assert(rc == 0);
+    assert(finished == 10 && cancelled == 0);
+
+    /* Cancel a large group of coroutines. */
+    finished = 0;
+    for(i = 0; i != 1000; ++i)
+        groupgo(g, worker(now() + 10000));
+    rc = groupwait(g, now() + 10);
+    assert(rc == -1 && errno == ETIMEDOUT);
+    int64_t start = now();
+    groupcancel(g);
+    rc = groupwait(g, -1);
+    assert(rc == 0);
+    assert(finished == 0 && cancelled == 1000);
+    assert(now() - start < 1000);
+
+    /* Coroutines launched into a cancelled group are cancelled straight
+       away. */
+    cancelled = 0;
+    groupgo(g, worker(now() + 10000));
+    rc = groupwait(g, -1);
+    assert(rc == 0);
+    assert(cancelled == 1);
+    groupclose(g);
+
+    /* Closing the group cancels the coroutines that are still running. */
+    cancelled = 0;
+    g = groupmake();
+    assert(g);
+    for(i = 0; i != 10; ++i)
+        groupgo(g, worker(now() + 10000));
+    groupclose(g);
+    msleep(now() + 10);
+    assert(cancelled == 10);
+
+    return 0;
+}
+
@@ -0,0 +1,104 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#define MILL_INLINE
+#include <assert.h>
+#include <errno.h>
+
+#include "../libmill.h"
+
+coroutine void sender(chan ch, int val) {
+    chs(ch, int, val);
+}
+
+coroutine void receiver(chan ch, chan done) {
+    int val = chr(ch, int);
+    chs(done, int, val);
+}
+
+int main() {
+    /* Fast paths. */
+    chan ch = chmake(int, 3);
+    int i;
+    for(i = 0; i != 10; ++i) {
+        chs(ch, int, i);
+        assert(errno == 0);
+        chs(ch, int, i + 100);
+        int val = chr(ch, int);
+        assert(errno == 0 && val == i);
+        val = chr(ch, int);
+        assert(val == i + 100);
+    }
+
+    /* Blocked sender. */
+    chs(ch, int, 1);
+    chs(ch, int, 2);
+    chs(ch, int, 3);
+    go(sender(ch, 4));
+    for(i = 1; i != 5; ++i)
+        assert(chr(ch, int) == i);
+
+    assert(((struct mill_chanhdr_*)ch)->slow == 0);
+
+    /* Blocked receiver. */
+    chan done = chmake(int, 0);
+    go(receiver(ch, done));
+    chs(ch, int, 5);
+    assert(chr(done, int) == 5);
+    assert(((struct mill_chanhdr_*)ch)->slow == 0);
+
+    /* Done-with channel. */
+    chs(ch, int, 6);
+    chdone(ch, int, 7);
+    assert(chr(ch, int) == 6);
+    assert(chr(ch, int) == 7);
+    assert(chr(ch, int) == 7);
+    chclose(ch);
+
+    /* Channel in a channel set. */
+    ch = chmake(int, 2);
+    chset s = chsetmake();
+    int rc = chsetadd(s, ch);
+    assert(rc == 0);
+    chs(ch, int, 8);
+    chan ready[1];
+    rc = chsetwait(s, ready, 1, -1);
+    assert(rc == 1 && ready[0] == ch);
+    assert(chr(ch, int) == 8);
+    chsetclose(s);
+    assert(((struct mill_chanhdr_*)ch)->slow == 0);
+    chs(ch, int, 9);
+    assert(chr(ch, int) == 9);
+    chclose(ch);
+
+    /* Timer channels. */
+    chan lim = chlimiter(1000, 2);
+    chr(lim, int64_t);
+    chr(lim, int64_t);
+    chr(lim, int64_t);
+    chclose(lim);
+
+    chclose(done);
+    return 0;
+}
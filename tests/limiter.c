@@ -0,0 +1,100 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "../libmill.h"
+
+int received = 0;
+
+coroutine void worker(chan limiter, chan done) {
+    chr(limiter, int64_t);
+    ++received;
+    chs(done, int, 1);
+}
+
+int main() {
+    chan lim = chlimiter(0, 1);
+    assert(!lim && errno == EINVAL);
+    lim = chlimiter(100, 0);
+    assert(!lim && errno == EINVAL);
+
+    /* The bucket starts full. */
+    lim = chlimiter(100, 5);
+    assert(lim);
+    int64_t start = now();
+    int i;
+    for(i = 0; i != 5; ++i)
+        chr(lim, int64_t);
+    assert(now() - start < 5);
+
+    /* Then tokens arrive at the given rate. */
+    for(i = 0; i != 10; ++i)
+        chr(lim, int64_t);
+    int64_t duration = now() - start;
+    assert(duration >= 90 && duration < 130);
+
+    /* Full bucket doesn't grow any further. */
+    msleep(now() + 100);
+    start = now();
+    for(i = 0; i != 7; ++i)
+        chr(lim, int64_t);
+    duration = now() - start;
+    assert(duration >= 15 && duration < 40);
+
+    /* Coroutines waiting for a token queue on the limiter. */
+    chan done = chmake(int, 0);
+    for(i = 0; i != 3; ++i)
+        go(worker(lim, done));
+    msleep(now() + 35);
+    assert(received == 3);
+    for(i = 0; i != 3; ++i)
+        chr(done, int);
+
+    /* Waiting for a token can be combined with other events. */
+    msleep(now() + 60);
+    for(i = 0; i != 5; ++i)
+        chr(lim, int64_t);
+    int got = 0;
+    choose {
+    in(lim, int64_t, tm):
+        got = 1;
+    deadline(now() + 2):
+    end
+    }
+    assert(!got);
+    choose {
+    in(lim, int64_t, tm):
+        got = 1;
+    deadline(now() + 50):
+    end
+    }
+    assert(got);
+
+    chclose(done);
+    chclose(lim);
+    return 0;
+}
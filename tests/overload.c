@@ -48,6 +48,24 @@ int main() {
 
     msleep(now() + 500);
 
+    struct mill_pollstats stats;
+    pollstats(&stats);
+    assert(stats.switches > 0);
+
+    /* Rely on the elapsed time alone to check for the expired deadline. */
+    setpoll(0, 1000);
+    alarm(1);
+    msleep(now() + 100);
+    struct mill_pollstats stats2;
+    pollstats(&stats2);
+    assert(stats2.switches == stats.switches);
+    assert(stats2.timeouts > stats.timeouts);
+
+    /* Both triggers combined. */
+    setpoll(1000, 1000);
+    alarm(1);
+    msleep(now() + 100);
+
     return 0;
 }
 
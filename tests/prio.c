@@ -0,0 +1,88 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+
+#include "../libmill.h"
+
+int order[4];
+int norder = 0;
+
+coroutine void worker(int prio) {
+    int rc = setprio(prio);
+    assert(rc == 2);
+    yield();
+    order[norder++] = prio;
+}
+
+int spins = 0;
+int spinsatlow = -1;
+
+coroutine void spinner(void) {
+    setprio(0);
+    for(spins = 0; spins != 1000; ++spins)
+        yield();
+}
+
+coroutine void lowprio(void) {
+    setprio(3);
+    yield();
+    spinsatlow = spins;
+}
+
+int main() {
+    /* Invalid priorities. */
+    int rc = setprio(-1);
+    assert(rc == -1 && errno == EINVAL);
+    rc = setprio(4);
+    assert(rc == -1 && errno == EINVAL);
+
+    /* Higher-priority coroutines are executed first. */
+    rc = setprio(0);
+    assert(rc == 2);
+    go(worker(3));
+    go(worker(1));
+    go(worker(0));
+    go(worker(2));
+    rc = setprio(2);
+    assert(rc == 0);
+    msleep(now() + 10);
+    assert(norder == 4);
+    assert(order[0] == 0);
+    assert(order[1] == 1);
+    assert(order[2] == 2);
+    assert(order[3] == 3);
+
+    /* Lower-priority coroutines are not starved. */
+    go(lowprio());
+    go(spinner());
+    msleep(now() + 10);
+    assert(spins == 1000);
+    assert(spinsatlow >= 0 && spinsatlow < 1000);
+
+    return 0;
+}
+
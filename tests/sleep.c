@@ -34,6 +34,11 @@ coroutine static void delay(int n, chan ch) {
     chs(ch, int, n);
 }
 
+coroutine static void delayns(int n, chan ch) {
+    msleepns(nowns() + n * 1000);
+    chs(ch, int, n);
+}
+
 int main() {
     /* Test 'msleep'. */
     int64_t deadline = now() + 100;
@@ -52,6 +57,82 @@ int main() {
     assert(chr(ch, int) == 30);
     assert(chr(ch, int) == 40);
 
+    /* Finer-grained clocks are consistent with 'now'. */
+    int64_t ms = now();
+    int64_t us = nowus();
+    int64_t ns = nowns();
+    assert(us / 1000 - ms >= -1 && us / 1000 - ms < 20);
+    assert(ns / 1000 - us >= 0 && ns / 1000 - us < 20000);
+
+    /* Test 'msleepns'. It must never return before the deadline. */
+    deadline = nowns() + 300000;
+    msleepns(deadline);
+    diff = nowns() - deadline;
+    assert(diff >= 0 && diff < 20000000);
+
+    /* Test 'fdwaitns' timing out. */
+    deadline = nowns() + 500000;
+    assert(fdwaitns(-1, 0, deadline) == 0);
+    assert(nowns() >= deadline);
+
+    /* msleepns-sort with sub-millisecond differences */
+    go(delayns(900, ch));
+    go(delayns(300, ch));
+    go(delayns(600, ch));
+    assert(chr(ch, int) == 300);
+    assert(chr(ch, int) == 600);
+    assert(chr(ch, int) == 900);
+
+    /* With timer slack, nearby timers are fired by a single wakeup but
+       never before their deadlines. */
+    settimerslack(50000);
+    struct mill_pollstats before;
+    pollstats(&before);
+    int64_t start = now();
+    int i;
+    for(i = 1; i <= 10; ++i)
+        go(delay(i, ch));
+    for(i = 0; i != 10; ++i) {
+        int n = chr(ch, int);
+        assert(now() >= start + n);
+        assert(now() < start + n + 100);
+    }
+    struct mill_pollstats after;
+    pollstats(&after);
+    assert(after.idle - before.idle < 5);
+    settimerslack(0);
+
+#if defined __linux__
+    /* With precise timers sub-millisecond sleeps are not rounded up to
+       whole milliseconds. The timing is compared to the same loop run
+       without precise timers rather than to a fixed bound so that the test
+       doesn't fail on a loaded machine. */
+    int64_t begin = nowns();
+    for(i = 0; i != 50; ++i) {
+        deadline = nowns() + 100000;
+        msleepns(deadline);
+        assert(nowns() >= deadline);
+    }
+    int64_t coarse = nowns() - begin;
+    int rc = setprecisetimers(1);
+    assert(rc == 0);
+    begin = nowns();
+    for(i = 0; i != 50; ++i) {
+        deadline = nowns() + 100000;
+        msleepns(deadline);
+        assert(nowns() >= deadline);
+    }
+    assert(nowns() - begin <= coarse);
+    go(delayns(900, ch));
+    go(delayns(300, ch));
+    assert(chr(ch, int) == 300);
+    assert(chr(ch, int) == 900);
+    rc = setprecisetimers(0);
+    assert(rc == 0);
+#endif
+
+    chclose(ch);
+
     return 0;
 }
 
@@ -0,0 +1,192 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <errno.h>
+
+#include "../libmill.h"
+
+mutex mtx;
+sem sm;
+wg wgrp;
+cond cv;
+
+int counter = 0;
+int order[4];
+int norder = 0;
+
+coroutine void incrementer(int n) {
+    int i;
+    for(i = 0; i != n; ++i) {
+        int rc = mutexlock(&mtx, -1);
+        assert(rc == 0);
+        /* Yield while holding the mutex. */
+        int val = counter;
+        yield();
+        counter = val + 1;
+        mutexunlock(&mtx);
+    }
+    wgdone(&wgrp);
+}
+
+coroutine void locker(int id) {
+    int rc = mutexlock(&mtx, -1);
+    assert(rc == 0);
+    order[norder++] = id;
+    mutexunlock(&mtx);
+    wgdone(&wgrp);
+}
+
+coroutine void semworker(int id) {
+    int rc = semwait(&sm, -1);
+    assert(rc == 0);
+    order[norder++] = id;
+    wgdone(&wgrp);
+}
+
+coroutine void condwaiter(int id) {
+    int rc = mutexlock(&mtx, -1);
+    assert(rc == 0);
+    while(!counter) {
+        rc = condwait(&cv, &mtx, -1);
+        assert(rc == 0);
+    }
+    order[norder++] = id;
+    mutexunlock(&mtx);
+    wgdone(&wgrp);
+}
+
+coroutine void cancelledwaiter(void) {
+    int rc = mutexlock(&mtx, -1);
+    assert(rc == 0);
+    rc = condwait(&cv, &mtx, -1);
+    assert(rc == -1 && errno == ECANCELED);
+    /* The mutex is held even if the wait failed. */
+    mutexunlock(&mtx);
+}
+
+int main() {
+    mutexinit(&mtx);
+    seminit(&sm, 0);
+    wginit(&wgrp);
+    condinit(&cv);
+
+    /* Mutex protects a critical section across yields. */
+    wgadd(&wgrp, 3);
+    go(incrementer(100));
+    go(incrementer(100));
+    go(incrementer(100));
+    int rc = wgwait(&wgrp, -1);
+    assert(rc == 0);
+    assert(counter == 300);
+
+    /* Mutex is handed over to the waiters in FIFO order. */
+    rc = mutexlock(&mtx, -1);
+    assert(rc == 0);
+    wgadd(&wgrp, 3);
+    go(locker(1));
+    go(locker(2));
+    go(locker(3));
+    mutexunlock(&mtx);
+    /* The mutex was handed over to the first waiter. */
+    rc = mutexlock(&mtx, now() + 10);
+    assert(rc == 0);
+    assert(norder == 3);
+    assert(order[0] == 1 && order[1] == 2 && order[2] == 3);
+    mutexunlock(&mtx);
+    rc = wgwait(&wgrp, -1);
+    assert(rc == 0);
+
+    /* Locking with a deadline. */
+    rc = mutexlock(&mtx, -1);
+    assert(rc == 0);
+    wgadd(&wgrp, 1);
+    go(incrementer(1));
+    rc = wgwait(&wgrp, now() + 10);
+    assert(rc == -1 && errno == ETIMEDOUT);
+    mutexunlock(&mtx);
+    rc = wgwait(&wgrp, -1);
+    assert(rc == 0);
+
+    /* Semaphore. */
+    norder = 0;
+    wgadd(&wgrp, 3);
+    go(semworker(1));
+    go(semworker(2));
+    go(semworker(3));
+    sempost(&sm);
+    sempost(&sm);
+    msleep(now() + 10);
+    assert(norder == 2);
+    assert(order[0] == 1 && order[1] == 2);
+    rc = semwait(&sm, now() + 10);
+    assert(rc == -1 && errno == ETIMEDOUT);
+    sempost(&sm);
+    sempost(&sm);
+    rc = semwait(&sm, -1);
+    assert(rc == 0);
+    rc = wgwait(&wgrp, -1);
+    assert(rc == 0);
+    assert(norder == 3 && order[2] == 3);
+
+    /* Condition variable. */
+    counter = 0;
+    norder = 0;
+    wgadd(&wgrp, 3);
+    go(condwaiter(1));
+    go(condwaiter(2));
+    go(condwaiter(3));
+    rc = mutexlock(&mtx, -1);
+    assert(rc == 0);
+    counter = 1;
+    condsignal(&cv);
+    mutexunlock(&mtx);
+    msleep(now() + 10);
+    assert(norder == 1 && order[0] == 1);
+    rc = mutexlock(&mtx, -1);
+    assert(rc == 0);
+    condbroadcast(&cv);
+    mutexunlock(&mtx);
+    rc = wgwait(&wgrp, -1);
+    assert(rc == 0);
+    assert(norder == 3 && order[1] == 2 && order[2] == 3);
+
+    /* Condition wait with a deadline re-acquires the mutex. */
+    rc = mutexlock(&mtx, -1);
+    assert(rc == 0);
+    rc = condwait(&cv, &mtx, now() + 10);
+    assert(rc == -1 && errno == ETIMEDOUT);
+    mutexunlock(&mtx);
+
+    /* Cancelled condition wait re-acquires the mutex. */
+    gohandle h = goh(cancelledwaiter());
+    rc = mutexlock(&mtx, -1);
+    assert(rc == 0);
+    gocancel(h);
+    mutexunlock(&mtx);
+    rc = gojoin(h, -1);
+    assert(rc == 0);
+
+    return 0;
+}
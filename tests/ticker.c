@@ -0,0 +1,92 @@
+/*
+
+  Copyright (c) 2015 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "../libmill.h"
+
+int main() {
+    /* One-shot timer. */
+    int64_t start = now();
+    chan after = chafter(start + 50);
+    assert(after);
+    int64_t tm = chr(after, int64_t);
+    assert(tm >= start + 50 && tm < start + 70);
+    assert(now() >= start + 50);
+    chclose(after);
+
+    /* Timer that was closed before it expired. */
+    after = chafter(now() + 10);
+    chclose(after);
+    msleep(now() + 20);
+
+    /* Ticker doesn't drift even if the receiver is late. */
+    start = now();
+    chan ticker = chticker(20);
+    assert(ticker);
+    int i;
+    for(i = 1; i <= 5; ++i) {
+        tm = chr(ticker, int64_t);
+        assert(tm >= start + i * 20 && tm < start + i * 20 + 15);
+        msleep(now() + 5);
+    }
+
+    /* Ticks that weren't received are dropped. */
+    msleep(now() + 70);
+    tm = chr(ticker, int64_t);
+    int64_t nw = now();
+    choose {
+    in(ticker, int64_t, val):
+        assert(0);
+    otherwise:
+    end
+    }
+    tm = chr(ticker, int64_t);
+    assert(tm >= nw && tm <= nw + 25);
+
+    /* Ticker and timer combined in a choose. */
+    after = chafter(now() + 50);
+    int ticks = 0;
+    int done = 0;
+    while(!done) {
+        choose {
+        in(ticker, int64_t, val):
+            ++ticks;
+        in(after, int64_t, val):
+            done = 1;
+        end
+        }
+    }
+    assert(ticks >= 1 && ticks <= 3);
+    chclose(after);
+    chclose(ticker);
+
+    /* Invalid period. */
+    ticker = chticker(0);
+    assert(!ticker && errno == EINVAL);
+
+    return 0;
+}
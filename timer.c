@@ -22,6 +22,7 @@
 
 */
 
+#include <limits.h>
 #include <stdint.h>
 #include <sys/time.h>
 #include <time.h>
@@ -35,69 +36,259 @@ static mach_timebase_info_data_t mill_mtid = {0};
 #include "timer.h"
 #include "utils.h"
 
-/* 1 millisecond expressed in CPU ticks. The value is chosen is such a way that
-   it works reasonably well for CPU frequencies above 500MHz. On significanly
-   slower machines you may wish to reconsider. */
-#define MILL_CLOCK_PRECISION 1000000
+#if (defined __GNUC__ || defined __clang__) && \
+      (defined __i386__ || defined __x86_64__)
+#include <cpuid.h>
+#define MILL_TSC 1
+#endif
 
-/* Returns current time by querying the operating system. */
-static int64_t mill_os_time(void) {
+int64_t mill_os_time_ns(void) {
 #if defined __APPLE__
     if (mill_slow(!mill_mtid.denom))
         mach_timebase_info(&mill_mtid);
     uint64_t ticks = mach_absolute_time();
-    return (int64_t)(ticks * mill_mtid.numer / mill_mtid.denom / 1000000);
+    return (int64_t)(ticks * mill_mtid.numer / mill_mtid.denom);
 #elif defined CLOCK_MONOTONIC
     struct timespec ts;
     int rc = clock_gettime(CLOCK_MONOTONIC, &ts);
     mill_assert (rc == 0);
-    return ((int64_t)ts.tv_sec) * 1000 + (((int64_t)ts.tv_nsec) / 1000000);
+    return ((int64_t)ts.tv_sec) * 1000000000 + ((int64_t)ts.tv_nsec);
 #else
     struct timeval tv;
     int rc = gettimeofday(&tv, NULL);
     assert(rc == 0);
-    return ((int64_t)tv.tv_sec) * 1000 + (((int64_t)tv.tv_usec) / 1000);
+    return ((int64_t)tv.tv_sec) * 1000000000 + ((int64_t)tv.tv_usec) * 1000;
 #endif
 }
 
-int64_t mill_now_(void) {
-#if (defined __GNUC__ || defined __clang__) && \
-      (defined __i386__ || defined __x86_64__)
-    /* Get the timestamp counter. This is time since startup, expressed in CPU
-       cycles. Unlike gettimeofday() or similar function, it's extremely fast -
-       it takes only few CPU cycles to evaluate. */
+#if defined MILL_TSC
+
+/* Time is computed from the timestamp counter as follows:
+
+       ns = basens + ((tsc - base) * mult) >> MILL_TSC_SHIFT
+
+   To keep the multiplication from overflowing, the base is moved forward
+   once the TSC has progressed by 'limit' ticks. At that point the TSC
+   frequency is re-calibrated against the OS clock and any offset between
+   the two clocks is corrected by slightly adjusting 'mult' for the next
+   interval. The time thus never jumps back. The interval starts short,
+   while the calibration is still imprecise, and doubles up to 2^32 ticks
+   (about a second). */
+#define MILL_TSC_SHIFT 24
+#define MILL_TSC_MINREBASE (1ULL << 24)
+#define MILL_TSC_REBASE (1ULL << 32)
+
+/* Initial calibration is done against the OS clock over this number of
+   nanoseconds. Until then the OS clock is used directly. */
+#define MILL_TSC_CALIBRATION 10000000
+
+/* Reading the OS clock takes much less than this number of ticks. If it takes
+   more, the thread was most likely preempted and the sample is useless. */
+#define MILL_TSC_MAXGAP 20000
+#define MILL_TSC_ATTEMPTS 5
+
+/* If the TSC clock falls behind the OS clock by more than this number of
+   nanoseconds it steps forward rather than slewing. */
+#define MILL_TSC_MAXSLEW 1000000
+
+static struct {
+    /* 0 - not yet known, 1 - TSC is invariant, -1 - TSC can't be used. */
+    int state;
+    /* Nanoseconds per tick, shifted left by MILL_TSC_SHIFT, as used for
+       computing the time. 0 if not yet calibrated. */
+    uint64_t mult;
+    uint64_t base;
+    int64_t basens;
+    /* Number of ticks after which the base is moved. */
+    uint64_t limit;
+    /* Measured nanoseconds per tick, without the offset correction. */
+    uint64_t rawmult;
+    /* Last reliable pair of TSC and OS clock readings. */
+    uint64_t caltsc;
+    int64_t calns;
+} mill_tsc = {0};
+
+static uint64_t mill_rdtsc(void) {
     uint32_t low;
     uint32_t high;
     __asm__ volatile("rdtsc" : "=a" (low), "=d" (high));
-    int64_t tsc = (int64_t)((uint64_t)high << 32 | low);
-    /* These global variables are used to hold the last seen timestamp counter
-       and last seen time measurement. We'll initilise them the first time
-       this function is called. */
-    static int64_t last_tsc = -1;
-    static int64_t last_now = -1;
-    if(mill_slow(last_tsc < 0)) {
-        last_tsc = tsc;
-        last_now = mill_os_time();
-    }   
-    /* If TSC haven't jumped back or progressed more than 1/2 ms, we can use
-       the cached time value. */
-    if(mill_fast(tsc - last_tsc <= (MILL_CLOCK_PRECISION / 2) &&
-          tsc >= last_tsc))
-        return last_now;
-    /* It's more than 1/2 ms since we've last measured the time.
-       We'll do a new measurement now. */
-    last_tsc = tsc;
-    last_now = mill_os_time();
-    return last_now;
+    return (uint64_t)high << 32 | low;
+}
+
+/* Reads the TSC and the OS clock at the same moment, as close as possible.
+   Returns 0 if no reliable sample could be taken. */
+static int mill_tsc_sample(uint64_t *tsc, int64_t *ns) {
+    int i;
+    for(i = 0; i != MILL_TSC_ATTEMPTS; ++i) {
+        uint64_t before = mill_rdtsc();
+        *ns = mill_os_time_ns();
+        uint64_t after = mill_rdtsc();
+        *tsc = before + (after - before) / 2;
+        if(after - before < MILL_TSC_MAXGAP)
+            return 1;
+    }
+    return 0;
+}
+
+/* TSC can be used for measuring time only if it ticks at constant rate
+   irrespective of CPU frequency scaling and sleep states. */
+static int mill_tsc_invariant(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+        return 0;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1;
+}
+
+/* Newer CPUs report the TSC frequency directly. Returns 0 if unknown. */
+static uint64_t mill_tsc_cpuidfreq(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if(__get_cpuid_max(0, NULL) < 0x15)
+        return 0;
+    __cpuid(0x15, eax, ebx, ecx, edx);
+    if(!eax || !ebx || !ecx)
+        return 0;
+    return (uint64_t)ecx * ebx / eax;
+}
+
+/* Converts ticks into nanoseconds without overflowing. */
+static int64_t mill_tsc_ns(uint64_t ticks, uint64_t mult) {
+    return (int64_t)((ticks >> MILL_TSC_SHIFT) * mult +
+        (((ticks & ((1ULL << MILL_TSC_SHIFT) - 1)) * mult) >> MILL_TSC_SHIFT));
+}
+
+/* Slow path of mill_nowns_(). Deals with the TSC not being calibrated yet
+   and with moving the base forward. */
+static int64_t mill_tsc_slow(void) {
+    uint64_t tsc;
+    int64_t nw;
+    if(mill_slow(!mill_tsc.state)) {
+        mill_tsc.state = mill_tsc_invariant() ? 1 : -1;
+        if(mill_tsc.state < 0)
+            return mill_os_time_ns();
+        if(!mill_tsc_sample(&tsc, &nw)) {
+            /* Try again next time. */
+            mill_tsc.state = 0;
+            return nw;
+        }
+        mill_tsc.base = mill_tsc.caltsc = tsc;
+        mill_tsc.basens = mill_tsc.calns = nw;
+        uint64_t freq = mill_tsc_cpuidfreq();
+        if(freq) {
+            mill_tsc.mult = mill_tsc.rawmult =
+                (1000000000ULL << MILL_TSC_SHIFT) / freq;
+            mill_tsc.limit = MILL_TSC_MINREBASE;
+        }
+        return nw;
+    }
+    if(mill_tsc.state < 0)
+        return mill_os_time_ns();
+    int good = mill_tsc_sample(&tsc, &nw);
+    /* TSCs on different CPUs are out of sync. Give up on TSC for good. */
+    if(tsc < mill_tsc.base) {
+        mill_tsc.state = -1;
+        mill_tsc.mult = 0;
+        return nw;
+    }
+    /* Measure the TSC frequency using the raw readings only. */
+    if(good) {
+        uint64_t ticks = tsc - mill_tsc.caltsc;
+        int64_t elapsed = nw - mill_tsc.calns;
+        if(!mill_tsc.rawmult && elapsed < MILL_TSC_CALIBRATION)
+            return nw;
+        if(ticks && elapsed > 0 &&
+              elapsed < (INT64_C(1) << (63 - MILL_TSC_SHIFT)))
+            mill_tsc.rawmult = ((uint64_t)elapsed << MILL_TSC_SHIFT) / ticks;
+        mill_tsc.caltsc = tsc;
+        mill_tsc.calns = nw;
+    }
+    if(!mill_tsc.rawmult)
+        return nw;
+    /* First calibration is done. Start using the TSC. */
+    if(!mill_tsc.mult) {
+        mill_tsc.mult = mill_tsc.rawmult;
+        mill_tsc.base = tsc;
+        mill_tsc.basens = nw;
+        mill_tsc.limit = MILL_TSC_MINREBASE;
+        return nw;
+    }
+    /* Move the base forward, keeping the TSC clock continuous. The offset
+       correction was meant for a single interval only. If we got here later
+       than that, the rest of the time is measured at the raw rate. */
+    uint64_t ticks = tsc - mill_tsc.base;
+    int64_t current = mill_tsc.basens;
+    if(ticks > mill_tsc.limit) {
+        current += mill_tsc_ns(mill_tsc.limit, mill_tsc.mult) +
+            mill_tsc_ns(ticks - mill_tsc.limit, mill_tsc.rawmult);
+    }
+    else {
+        current += mill_tsc_ns(ticks, mill_tsc.mult);
+    }
+    mill_tsc.base = tsc;
+    mill_tsc.basens = current;
+    mill_tsc.mult = mill_tsc.rawmult;
+    if(mill_tsc.limit < MILL_TSC_REBASE)
+        mill_tsc.limit *= 2;
+    if(!good)
+        return current;
+    /* If we are way behind the OS clock, jump forward. Otherwise adjust
+       the rate so that the offset disappears by the next rebase. The rate
+       is never changed by more than a half. */
+    int64_t offset = nw - current;
+    if(offset > MILL_TSC_MAXSLEW) {
+        mill_tsc.basens = nw;
+        return nw;
+    }
+    int64_t maxoffset = INT64_C(1) << (62 - MILL_TSC_SHIFT);
+    if(offset < -maxoffset)
+        offset = -maxoffset;
+    int64_t adjust = (int64_t)(((uint64_t)(offset < 0 ? -offset : offset)
+        << MILL_TSC_SHIFT) / mill_tsc.limit);
+    if(adjust > (int64_t)(mill_tsc.rawmult / 2))
+        adjust = (int64_t)(mill_tsc.rawmult / 2);
+    if(offset < 0)
+        mill_tsc.mult -= adjust;
+    else
+        mill_tsc.mult += adjust;
+    return current;
+}
+
+#endif
+
+int64_t mill_nowns_(void) {
+#if defined MILL_TSC
+    uint64_t tsc = mill_rdtsc();
+    uint64_t ticks = tsc - mill_tsc.base;
+    if(mill_fast(mill_tsc.mult && tsc >= mill_tsc.base &&
+          ticks < mill_tsc.limit))
+        return mill_tsc.basens +
+            (int64_t)((ticks * mill_tsc.mult) >> MILL_TSC_SHIFT);
+    return mill_tsc_slow();
 #else
-    return mill_os_time();
+    return mill_os_time_ns();
 #endif
 }
 
+int64_t mill_nowus_(void) {
+    return mill_nowns_() / 1000;
+}
+
+int64_t mill_now_(void) {
+    return mill_nowns_() / 1000000;
+}
+
 /* Global linked list of all timers. The list is ordered.
    First timer to be resume comes first and so on. */
 static struct mill_list mill_timers = {0};
 
+/* Timers may fire up to this number of nanoseconds late so that timers
+   expiring at nearby moments can be fired by a single wakeup. */
+static int64_t mill_timer_slack = 0;
+
+void mill_settimerslack_(int64_t slack) {
+    mill_timer_slack = slack > 0 ? slack * 1000 : 0;
+}
+
 void mill_timer_add(struct mill_timer *timer, int64_t deadline,
       mill_timer_callback callback) {
     mill_assert(deadline >= 0);
@@ -123,20 +314,36 @@ void mill_timer_rm(struct mill_timer *timer) {
     timer->expiry = -1;
 }
 
-int mill_timer_next(void) {
+int64_t mill_timer_wakeup(void) {
     if(mill_list_empty(&mill_timers))
         return -1;
-    int64_t nw = now();
     int64_t expiry = mill_cont(mill_list_begin(&mill_timers),
         struct mill_timer, item)->expiry;
-    return (int) (nw >= expiry ? 0 : expiry - nw);
+    /* Postpone the wakeup to the next multiple of the slack. All the timers
+       that expire in the meantime will be fired together. */
+    if(mill_timer_slack && expiry <= INT64_MAX - mill_timer_slack)
+        expiry = (expiry + mill_timer_slack - 1) / mill_timer_slack *
+            mill_timer_slack;
+    return expiry;
+}
+
+int mill_timer_next(void) {
+    int64_t expiry = mill_timer_wakeup();
+    if(expiry < 0)
+        return -1;
+    int64_t nw = mill_nowns_();
+    if(nw >= expiry)
+        return 0;
+    /* Round up so that we don't wake up before the timer expires. */
+    int64_t timeout = (expiry - nw + 999999) / 1000000;
+    return (int) (timeout > INT_MAX ? INT_MAX : timeout);
 }
 
 int mill_timer_fire(void) {
     /* Avoid getting current time if there are no timers anyway. */
     if(mill_list_empty(&mill_timers))
         return 0;
-    int64_t nw = now();
+    int64_t nw = mill_nowns_();
     int fired = 0;
     while(!mill_list_empty(&mill_timers)) {
         struct mill_timer *tm = mill_cont(
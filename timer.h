@@ -36,24 +36,38 @@ typedef void (*mill_timer_callback)(struct mill_timer *timer);
 struct mill_timer {
     /* Item in the global list of all timers. */
     struct mill_list_item item;
-    /* The deadline when the timer expires. -1 if the timer is not active. */
+    /* The deadline when the timer expires, in nanoseconds.
+       -1 if the timer is not active. */
     int64_t expiry;
     /* Callback invoked when timer expires. Pfui Teufel! */
     mill_timer_callback callback;
 };
 
+/* Returns current time in nanoseconds by querying the operating system. */
+int64_t mill_os_time_ns(void);
+
+/* Converts a deadline in milliseconds into a deadline in nanoseconds.
+   Infinite deadline (-1) is left as it is. */
+#define mill_ms2ns(dd) ((dd) < 0 ? (dd) : (dd) > INT64_MAX / 1000000 ?\
+    INT64_MAX : (dd) * 1000000)
+
 /* Test wheather the timer is active. */
 #define mill_timer_enabled(tm)  ((tm)->expiry >= 0)
 
-/* Add a timer for the running coroutine. */
+/* Add a timer for the running coroutine. Deadline is in nanoseconds. */
 void mill_timer_add(struct mill_timer *timer, int64_t deadline,
     mill_timer_callback callback);
 
 /* Remove the timer associated with the running coroutine. */
 void mill_timer_rm(struct mill_timer *timer);
 
-/* Number of milliseconds till the next timer expires.
-   If there are no timers returns -1. */
+/* Time (in nanoseconds) when the scheduler should wake up to fire the next
+   timer(s). If there are no timers returns -1. */
+int64_t mill_timer_wakeup(void);
+
+/* Number of milliseconds till the next timer expires, rounded up.
+   If timer slack is set the value may be larger, so that multiple timers
+   can be fired at once. If there are no timers returns -1. */
 int mill_timer_next(void);
 
 /* Resumes all coroutines whose timers have already expired.
@@ -35,6 +35,7 @@
 
 #include "ip.h"
 #include "libmill.h"
+#include "poller.h"
 #include "utils.h"
 
 struct mill_udpsock_ {
@@ -49,6 +50,13 @@ static void mill_udptune(int s) {
         opt = 0;
     int rc = fcntl(s, F_SETFL, opt | O_NONBLOCK);
     mill_assert(rc != -1);
+#ifdef SO_BUSY_POLL
+    /* Same as in mill_tcptune(). Best effort only. */
+    if(mill_busypoll) {
+        opt = mill_busypoll;
+        setsockopt(s, SOL_SOCKET, SO_BUSY_POLL, &opt, sizeof (opt));
+    }
+#endif
 }
 
 struct mill_udpsock_ *mill_udplisten_(ipaddr addr) {
@@ -124,6 +132,8 @@ size_t mill_udprecv_(struct mill_udpsock_ *s, ipaddr *addr,
         if(errno != EAGAIN && errno != EWOULDBLOCK)
             return 0;
         int rc = fdwait(s->fd, FDW_IN, deadline);
+        if(rc < 0)
+            return 0;
         if(rc == 0) {
             errno = ETIMEDOUT;
             return 0;
@@ -160,6 +160,8 @@ struct mill_unixsock_ *mill_unixaccept_(struct mill_unixsock_ *s,
             return NULL;
         /* Wait till new connection is available. */
         int rc = fdwait(l->fd, FDW_IN, deadline);
+        if(rc < 0)
+            return NULL;
         if(rc == 0) {
             errno = ETIMEDOUT;
             return NULL;
@@ -287,6 +289,8 @@ size_t mill_unixsend_(struct mill_unixsock_ *s, const void *buf, size_t len,
             if(errno != EAGAIN && errno != EWOULDBLOCK)
                 return 0;
             int rc = fdwait(conn->fd, FDW_OUT, deadline);
+            if(rc < 0)
+                return len - remaining;
             if(rc == 0) {
                 errno = ETIMEDOUT;
                 return len - remaining;
@@ -322,6 +326,8 @@ void mill_unixflush_(struct mill_unixsock_ *s, int64_t deadline) {
             if(errno != EAGAIN && errno != EWOULDBLOCK)
                 return;
             int rc = fdwait(conn->fd, FDW_OUT, deadline);
+            if(rc < 0)
+                return;
             if(rc == 0) {
                 errno = ETIMEDOUT;
                 return;
@@ -411,6 +417,8 @@ size_t mill_unixrecv_(struct mill_unixsock_ *s, void *buf, size_t len,
 
         /* Wait till there's more data to read. */
         int res = fdwait(conn->fd, FDW_IN, deadline);
+        if(res < 0)
+            return len - remaining;
         if(!res) {
             errno = ETIMEDOUT;
             return len - remaining;